@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "famtree.h"
+
+/* famdaemon.c
+   Riley Crockett
+
+   This keeps a validated family tree in memory and applies edits to it as they
+   arrive, either on standard input or on a Unix socket. An edit (a "delta") is
+   a run of ordinary input lines ended by a blank line or EOF. Each delta is
+   checked and applied line by line:
+     - Sex and parent errors are caught by CheckSex and CheckLink.
+     - Cycles are caught by keeping a topological order of everyone and fixing
+       it up for each new link (Pearce and Kelly). Adding a link from x to y
+       only has to look at people whose positions lie between y's and x's,
+       instead of searching the whole tree again.
+   If any line fails, everything the delta did is undone from an undo log and
+   the error is sent back. Otherwise the reply is "OK n", followed by the new
+   records of just the n people whose output changed, in parents-first order.
+
+   The children and parents of each person are the CSR arrays the tree was
+   loaded with, plus a growable array of links added since.
+   */
+
+/* This is the error for a link that would make a cycle. It is not a LINK_
+   error, since famtree reports cycles without a line number. */
+
+#define LINK_CYCLE (-1)
+
+/* This struct defines one direction of the graph: a CSR base and per-person
+   arrays of links added after it was built. */
+
+typedef struct adj {
+  int base_n;        /* The number of people the CSR base covers. */
+  int *start;
+  int *list;
+  int **extra;
+  int *nextra;
+  int *extra_cap;
+} Adj;
+
+/* An undo log entry. For UNDO_SEX, UNDO_FATHER and UNDO_MOTHER, old is the
+   value id had before. UNDO_CHILD and UNDO_PARENT drop id's newest link. */
+
+enum { UNDO_SEX, UNDO_FATHER, UNDO_MOTHER, UNDO_CHILD, UNDO_PARENT };
+
+typedef struct undo {
+  int kind;
+  int id;
+  int old;
+} Undo;
+
+/* This struct defines the daemon's state. Every per-person array has room for
+   cap people. */
+
+typedef struct daemon {
+  FamTree *t;
+  Adj kids;
+  Adj parents;
+  int *ord;          /* Each person's position in a topological order. Positions
+                        are distinct, but need not be contiguous. */
+  int next_ord;
+  int cap;
+
+  int *mark;         /* Search marks: p is marked when mark[p] == stamp. */
+  int stamp;
+  int *stack;
+  int *fwd;
+  int *bwd;
+  int *pool;
+
+  int *touched_in;   /* The delta that last changed each person's output. */
+  int *touched;
+  int ntouched;
+  int delta;
+
+  Undo *undo;
+  int nundo;
+  int undo_cap;
+  int *scratch;      /* Room to gather one person's children for printing. */
+  int scratch_cap;
+} Daemon;
+
+/* @name: Degree
+   @brief: Counts a person's links in one direction.
+   @param[in] a: The direction.
+   @param[in] p: The person.
+   @return: Returns the number of links. */
+
+int Degree(Adj *a, int p) {
+  return ((p < a->base_n) ? a->start[p+1] - a->start[p] : 0) + a->nextra[p];
+}
+
+/* @name: Neighbor
+   @brief: Gets one of a person's links, base links first, in the order they were made.
+   @param[in] a: The direction.
+   @param[in] p: The person.
+   @param[in] i: The link's index, less than Degree(a, p).
+   @return: Returns the person at the other end. */
+
+int Neighbor(Adj *a, int p, int i) {
+  int nbase;
+
+  nbase = (p < a->base_n) ? a->start[p+1] - a->start[p] : 0;
+  return (i < nbase) ? a->list[a->start[p] + i] : a->extra[p][i - nbase];
+}
+
+/* @name: AdjAdd
+   @brief: Adds a link from p to q.
+   @param[in] a: The direction.
+   @param[in] p, q: The two people. */
+
+void AdjAdd(Adj *a, int p, int q) {
+  if (a->nextra[p] == a->extra_cap[p]) {
+    a->extra_cap[p] = (a->extra_cap[p] == 0) ? 4 : a->extra_cap[p] * 2;
+    a->extra[p] = realloc(a->extra[p], sizeof(int)*a->extra_cap[p]);
+  }
+  a->extra[p][a->nextra[p]++] = q;
+}
+
+/* @name: AdjGrow
+   @brief: Makes room for links from people up to cap.
+   @param[in] a: The direction.
+   @param[in] old_cap: The number of people there was room for.
+   @param[in] cap: The number of people to make room for. */
+
+void AdjGrow(Adj *a, int old_cap, int cap) {
+  a->extra = realloc(a->extra, sizeof(int *)*cap);
+  a->nextra = realloc(a->nextra, sizeof(int)*cap);
+  a->extra_cap = realloc(a->extra_cap, sizeof(int)*cap);
+  memset(a->extra + old_cap, 0, sizeof(int *)*(cap - old_cap));
+  memset(a->nextra + old_cap, 0, sizeof(int)*(cap - old_cap));
+  memset(a->extra_cap + old_cap, 0, sizeof(int)*(cap - old_cap));
+}
+
+/* @name: EnsureRoom
+   @brief: Grows the daemon's per-person arrays to cover everyone in the tree.
+   @param[in] d: The daemon. */
+
+void EnsureRoom(Daemon *d) {
+  int old_cap;
+
+  if (d->t->n <= d->cap) return;
+  old_cap = d->cap;
+  d->cap = (d->t->n > 2 * d->cap) ? d->t->n : 2 * d->cap;
+  AdjGrow(&d->kids, old_cap, d->cap);
+  AdjGrow(&d->parents, old_cap, d->cap);
+  d->ord = realloc(d->ord, sizeof(int)*d->cap);
+  d->mark = realloc(d->mark, sizeof(int)*d->cap);
+  d->stack = realloc(d->stack, sizeof(int)*d->cap);
+  d->fwd = realloc(d->fwd, sizeof(int)*d->cap);
+  d->bwd = realloc(d->bwd, sizeof(int)*d->cap);
+  d->pool = realloc(d->pool, sizeof(int)*d->cap);
+  d->touched_in = realloc(d->touched_in, sizeof(int)*d->cap);
+  d->touched = realloc(d->touched, sizeof(int)*d->cap);
+  memset(d->mark + old_cap, 0, sizeof(int)*(d->cap - old_cap));
+  memset(d->touched_in + old_cap, 0, sizeof(int)*(d->cap - old_cap));
+}
+
+/* @name: ThawTree
+   @brief: Copies a tree loaded from a snapshot into one that can grow. The
+           children arrays are shared, since the daemon never changes them.
+   @param[in] m: The mapped tree.
+   @return: Returns the copy. */
+
+FamTree *ThawTree(FamTree *m) {
+  FamTree *t;
+  int i;
+
+  t = NewFamTree();
+  for (i = 0; i < m->n; i++) GetPerson(t, m->name[i], strlen(m->name[i]));
+  memcpy(t->sex, m->sex, sizeof(unsigned char)*m->n);
+  memcpy(t->father, m->father, sizeof(int)*m->n);
+  memcpy(t->mother, m->mother, sizeof(int)*m->n);
+  t->child_start = m->child_start;
+  t->children = m->children;
+  return t;
+}
+
+/* @name: NewDaemon
+   @brief: Sets up the daemon's graph and topological order from a validated tree.
+   @param[in] t: The tree.
+   @param[in] order: Its print order.
+   @return: Returns the daemon. */
+
+Daemon *NewDaemon(FamTree *t, int *order) {
+  Daemon *d;
+  int i;
+
+  d = calloc(1, sizeof(Daemon));
+  d->t = (t->map != NULL) ? ThawTree(t) : t;
+  d->kids.base_n = t->n;
+  d->kids.start = d->t->child_start;
+  d->kids.list = d->t->children;
+  d->parents.base_n = t->n;
+  InvertChildren(d->t, &d->parents.start, &d->parents.list);
+  EnsureRoom(d);
+
+  for (i = 0; i < t->n; i++) d->ord[order[i]] = i;
+  d->next_ord = t->n;
+  return d;
+}
+
+/* The daemon whose order CompareOrd sorts by. */
+Daemon *SortDaemon;
+
+/* @name: CompareOrd
+   @brief: A qsort comparison function that orders person IDs by topological position.
+   @param[in] a, b: Pointers to the IDs.
+   @return: Returns a negative, zero or positive number. */
+
+int CompareOrd(const void *a, const void *b) {
+  return SortDaemon->ord[*(int *) a] - SortDaemon->ord[*(int *) b];
+}
+
+/* @name: CompareInts
+   @brief: A qsort comparison function for ints.
+   @param[in] a, b: Pointers to the ints.
+   @return: Returns a negative, zero or positive number. */
+
+int CompareInts(const void *a, const void *b) {
+  return (*(int *) a > *(int *) b) - (*(int *) a < *(int *) b);
+}
+
+/* @name: OrderLink
+   @brief: Keeps the topological order valid for a new link from parent x to
+           child y (Pearce and Kelly). If x is already before y, nothing
+           changes. Otherwise, the people below y that come before x (fwd)
+           and the people above x that come after y (bwd) are found; if fwd
+           reaches x, the link closes a cycle. If not, bwd and fwd swap into
+           the same positions, with all of bwd first. Nobody else moves.
+   @param[in] d: The daemon.
+   @param[in] x: The parent.
+   @param[in] y: The child.
+   @return: Returns 1 if the link would make a cycle, otherwise 0. */
+
+int OrderLink(Daemon *d, int x, int y) {
+  int i, c, w, sp, nf, nb;
+
+  if (x == y) return 1;
+  if (d->ord[x] < d->ord[y]) return 0;
+
+  d->stamp++;
+  nf = 0;
+  sp = 0;
+  d->stack[sp++] = y;
+  d->mark[y] = d->stamp;
+  while (sp > 0) {
+    w = d->stack[--sp];
+    d->fwd[nf++] = w;
+    for (i = 0; i < Degree(&d->kids, w); i++) {
+      c = Neighbor(&d->kids, w, i);
+      if (c == x) return 1;
+      if (d->mark[c] != d->stamp && d->ord[c] < d->ord[x]) {
+        d->mark[c] = d->stamp;
+        d->stack[sp++] = c;
+      }
+    }
+  }
+
+  nb = 0;
+  sp = 0;
+  d->stack[sp++] = x;
+  d->mark[x] = d->stamp;
+  while (sp > 0) {
+    w = d->stack[--sp];
+    d->bwd[nb++] = w;
+    for (i = 0; i < Degree(&d->parents, w); i++) {
+      c = Neighbor(&d->parents, w, i);
+      if (d->mark[c] != d->stamp && d->ord[c] > d->ord[y]) {
+        d->mark[c] = d->stamp;
+        d->stack[sp++] = c;
+      }
+    }
+  }
+
+  /* Keep each side's relative order, and hand out their old positions with bwd first. */
+
+  SortDaemon = d;
+  qsort(d->fwd, nf, sizeof(int), CompareOrd);
+  qsort(d->bwd, nb, sizeof(int), CompareOrd);
+  for (i = 0; i < nb; i++) d->pool[i] = d->ord[d->bwd[i]];
+  for (i = 0; i < nf; i++) d->pool[nb+i] = d->ord[d->fwd[i]];
+  qsort(d->pool, nb+nf, sizeof(int), CompareInts);
+  for (i = 0; i < nb; i++) d->ord[d->bwd[i]] = d->pool[i];
+  for (i = 0; i < nf; i++) d->ord[d->fwd[i]] = d->pool[nb+i];
+  return 0;
+}
+
+/* @name: Log
+   @brief: Adds an entry to the undo log.
+   @param[in] d: The daemon.
+   @param[in] kind, id, old: The entry. */
+
+void Log(Daemon *d, int kind, int id, int old) {
+  if (d->nundo == d->undo_cap) {
+    d->undo_cap = (d->undo_cap == 0) ? 64 : d->undo_cap * 2;
+    d->undo = realloc(d->undo, sizeof(Undo)*d->undo_cap);
+  }
+  d->undo[d->nundo].kind = kind;
+  d->undo[d->nundo].id = id;
+  d->undo[d->nundo].old = old;
+  d->nundo++;
+}
+
+/* @name: Touch
+   @brief: Notes that a person's record changed in this delta.
+   @param[in] d: The daemon.
+   @param[in] p: The person. */
+
+void Touch(Daemon *d, int p) {
+  if (d->touched_in[p] == d->delta) return;
+  d->touched_in[p] = d->delta;
+  d->touched[d->ntouched++] = p;
+}
+
+/* @name: SetField
+   @brief: Changes a person's sex, father or mother, logging the old value.
+   @param[in] d: The daemon.
+   @param[in] kind: UNDO_SEX, UNDO_FATHER or UNDO_MOTHER.
+   @param[in] p: The person.
+   @param[in] val: The new value. */
+
+void SetField(Daemon *d, int kind, int p, int val) {
+  int *field;
+
+  if (kind == UNDO_SEX) {
+    if (d->t->sex[p] == val) return;
+    Log(d, kind, p, d->t->sex[p]);
+    d->t->sex[p] = val;
+  } else {
+    field = (kind == UNDO_FATHER) ? d->t->father : d->t->mother;
+    if (field[p] == val) return;
+    Log(d, kind, p, field[p]);
+    field[p] = val;
+  }
+  Touch(d, p);
+}
+
+/* @name: ApplyLine
+   @brief: Checks and applies one line of a delta, the way ReadTree and
+           CreateLink would, but logging every change so it can be undone.
+   @param[in] d: The daemon.
+   @param[in] l: The line.
+   @param[in,out] op: The overlying person.
+   @return: Returns LINK_OK, a LINK_ error, or LINK_CYCLE. */
+
+int ApplyLine(Daemon *d, Line *l, int *op) {
+  FamTree *t = d->t;
+  int p, n, err, parent, child;
+
+  if (l->rel == REL_SEX) {
+    if (*op == -1 || l->fw_len != 1 || (l->name[0] != 'F' && l->name[0] != 'M')) return LINK_OK;
+    if ((err = CheckSex(t, *op, (l->name[0] == 'F') ? FEMALE : MALE)) != LINK_OK) return err;
+    SetField(d, UNDO_SEX, *op, (l->name[0] == 'F') ? FEMALE : MALE);
+    return LINK_OK;
+  }
+  if (*op == -1 && l->rel != REL_PERSON) return LINK_OK;
+
+  n = t->n;
+  p = GetPerson(t, l->name, l->len);
+  if (t->n > n) {
+    EnsureRoom(d);
+    d->ord[p] = d->next_ord++;
+    Touch(d, p);
+  }
+  if (l->rel == REL_PERSON) *op = p;
+
+  if ((err = CheckLink(t, l->rel, *op, p)) != LINK_OK) return err;
+  if (l->rel == REL_MOTHER_OF || l->rel == REL_FATHER_OF) {
+    parent = *op;
+    child = p;
+  } else if (l->rel == REL_MOTHER || l->rel == REL_FATHER) {
+    parent = p;
+    child = *op;
+  } else {
+    return LINK_OK;
+  }
+  if (OrderLink(d, parent, child)) return LINK_CYCLE;
+
+  if (l->rel == REL_MOTHER_OF || l->rel == REL_MOTHER) {
+    SetField(d, UNDO_MOTHER, child, parent);
+    SetField(d, UNDO_SEX, parent, FEMALE);
+  } else {
+    SetField(d, UNDO_FATHER, child, parent);
+    SetField(d, UNDO_SEX, parent, MALE);
+  }
+  AdjAdd(&d->kids, parent, child);
+  Log(d, UNDO_CHILD, parent, 0);
+  AdjAdd(&d->parents, child, parent);
+  Log(d, UNDO_PARENT, child, 0);
+  Touch(d, parent);
+  Touch(d, child);
+  return LINK_OK;
+}
+
+/* @name: Rollback
+   @brief: Undoes everything in the undo log, newest first, and removes anyone
+           the delta added.
+   @param[in] d: The daemon.
+   @param[in] n: The number of people before the delta.
+   @param[in] nslots: The size of the name index before the delta. */
+
+void Rollback(Daemon *d, int n, unsigned int nslots) {
+  Undo *u;
+
+  while (d->nundo > 0) {
+    u = &d->undo[--d->nundo];
+    if (u->kind == UNDO_SEX) d->t->sex[u->id] = u->old;
+    if (u->kind == UNDO_FATHER) d->t->father[u->id] = u->old;
+    if (u->kind == UNDO_MOTHER) d->t->mother[u->id] = u->old;
+    if (u->kind == UNDO_CHILD) d->kids.nextra[u->id]--;
+    if (u->kind == UNDO_PARENT) d->parents.nextra[u->id]--;
+  }
+  TruncatePeople(d->t, n, nslots);
+}
+
+/* @name: Reply
+   @brief: Sends the result of a delta: the error, or "OK n" and the n changed
+           records in topological order.
+   @param[in] d: The daemon.
+   @param[in] out: The stream to reply on.
+   @param[in] err: The delta's error, or LINK_OK.
+   @param[in] line: The line the error occurred on. */
+
+void Reply(Daemon *d, FILE *out, int err, int line) {
+  int i, j, p, nkids;
+
+  if (err == LINK_CYCLE) {
+    fprintf(out, "Bad input -- cycle in specification on line %d\n", line);
+  } else if (err != LINK_OK) {
+    fprintf(out, "%s %d\n", LinkErrors[err], line);
+  } else {
+    SortDaemon = d;
+    qsort(d->touched, d->ntouched, sizeof(int), CompareOrd);
+    fprintf(out, "OK %d\n", d->ntouched);
+    for (i = 0; i < d->ntouched; i++) {
+      p = d->touched[i];
+      nkids = Degree(&d->kids, p);
+      if (nkids > d->scratch_cap) {
+        d->scratch_cap = 2 * nkids;
+        d->scratch = realloc(d->scratch, sizeof(int)*d->scratch_cap);
+      }
+      for (j = 0; j < nkids; j++) d->scratch[j] = Neighbor(&d->kids, p, j);
+      PrintRecord(out, d->t, p, d->scratch, nkids);
+    }
+  }
+  fflush(out);
+}
+
+/* @name: Serve
+   @brief: Reads deltas from a stream until EOF, applying and replying to each.
+   @param[in] d: The daemon.
+   @param[in] in: The stream to read deltas from.
+   @param[in] out: The stream to reply on. */
+
+void Serve(Daemon *d, FILE *in, FILE *out) {
+  char *buf;
+  size_t buf_cap;
+  ssize_t len;
+  Line l;
+  int line, op, nlines, err, err_line, n;
+  unsigned int nslots;
+
+  buf = NULL;
+  buf_cap = 0;
+  line = 0;
+  nlines = 0;
+
+  while (1) {
+    len = getline(&buf, &buf_cap, in);
+    if (len >= 0) {
+      line++;
+      LexLine(buf, (len > 0 && buf[len-1] == '\n') ? buf + len - 1 : buf + len, &l);
+    }
+
+    /* A blank line or EOF ends the current delta. */
+
+    if (len < 0 || l.nfields == 0) {
+      if (nlines > 0) {
+        if (err != LINK_OK) Rollback(d, n, nslots);
+        Reply(d, out, err, err_line);
+        nlines = 0;
+      }
+      if (len < 0) break;
+      continue;
+    }
+
+    if (nlines++ == 0) {
+      d->delta++;
+      d->ntouched = 0;
+      d->nundo = 0;
+      n = d->t->n;
+      nslots = d->t->nslots;
+      op = -1;
+      err = LINK_OK;
+    }
+
+    /* After an error, the rest of the delta is skipped. */
+    if (err != LINK_OK || l.nfields <= 1) continue;
+    if ((err = ApplyLine(d, &l, &op)) != LINK_OK) err_line = line;
+  }
+
+  free(buf);
+}
+
+/* @name: RunDaemon
+   @brief: Serves deltas against a validated tree, on standard input or on a
+           Unix socket. Socket clients are served one at a time, until killed.
+   @param[in] t: The tree.
+   @param[in] order: Its print order.
+   @param[in] path: The socket's path, or NULL for standard input. */
+
+void RunDaemon(FamTree *t, int *order, char *path) {
+  Daemon *d;
+  struct sockaddr_un sa;
+  int sfd, cfd;
+  FILE *in, *out;
+
+  d = NewDaemon(t, order);
+  if (path == NULL) {
+    Serve(d, stdin, stdout);
+    return;
+  }
+
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    fprintf(stderr, "famtree: socket path too long: %s\n", path);
+    exit(1);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+
+  sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sfd == -1) { perror("socket()"); exit(1); }
+  unlink(path);
+  if (bind(sfd, (struct sockaddr *) &sa, sizeof(sa)) == -1) { perror("bind()"); exit(1); }
+  if (listen(sfd, 8) == -1) { perror("listen()"); exit(1); }
+
+  /* A client that hangs up early should not take the daemon down with it. */
+  signal(SIGPIPE, SIG_IGN);
+
+  while (1) {
+    cfd = accept(sfd, NULL, NULL);
+    if (cfd == -1) { perror("accept()"); continue; }
+    in = fdopen(cfd, "r");
+    out = fdopen(dup(cfd), "w");
+    Serve(d, in, out);
+    fclose(in);
+    fclose(out);
+  }
+}
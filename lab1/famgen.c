@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* famgen.c
+   Riley Crockett
+
+   This writes a synthetic pedigree in famtree's input format, for benchmarking.
+
+   Usage: famgen [-n people] [-g generations] [-b branching] [-f of_fraction]
+                 [-l name_length] [-c cycles] [-s seed]
+
+   The people are split evenly into generations. Within a generation, even
+   positions are male and odd ones female, so positions 2i and 2i+1 form a
+   couple. Each person after the first generation is a child of a couple in
+   the generation before, with about branching children per couple. Each
+   parent link is written either on the parent's record (FATHER_OF/MOTHER_OF),
+   with probability of_fraction, or on the child's (FATHER/MOTHER). Records
+   come out in random order, so famtree has to do the ordering itself.
+
+   Names are name_length random letters followed by the person's number, so
+   they are unique. With -c, that many first-generation men are made the son
+   of one of their own male-line descendants, which famtree must reject as a
+   cycle.
+   */
+
+/* The state of the xorshift generator, so runs with the same seed match. */
+unsigned long long Seed = 88172645463325252ULL;
+
+/* @name: Random
+   @brief: Gets the next number from the xorshift generator.
+   @return: Returns a random 64-bit number. */
+
+unsigned long long Random() {
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 7;
+  Seed ^= Seed << 17;
+  return Seed;
+}
+
+/* @name: Chance
+   @brief: Flips a biased coin.
+   @param[in] p: The probability of heads.
+   @return: Returns 1 with probability p, otherwise 0. */
+
+int Chance(double p) {
+  return (Random() >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+/* @name: PrintName
+   @brief: Prints a person's name.
+   @param[in] names: Every person's random letters, name_len apiece.
+   @param[in] name_len: The number of letters in each name.
+   @param[in] p: The person. */
+
+void PrintName(char *names, int name_len, int p) {
+  fwrite(names + (size_t) p * name_len, 1, name_len, stdout);
+  printf(" %d\n", p);
+}
+
+int main(int argc, char **argv)
+{
+  int n;           /* The number of people. */
+  int gens;        /* The number of generations. */
+  int branching;   /* The number of children per couple. */
+  double of_frac;  /* The fraction of links written as FATHER_OF/MOTHER_OF. */
+  int name_len;    /* The number of random letters in each name. */
+  int ncycles;     /* The number of cycles to add. */
+  int *father, *mother, *gen_start, *perm, *cyc_father;
+  int *kids_start, *kids;  /* Each person's children, for the _OF lines. */
+  int *of_link;    /* Bit 0 (father) and bit 1 (mother): is the link written on the parent? */
+  char *names;
+  int i, j, k, c, g, p, size, prev, prev_size, ncouples, tmp;
+
+  n = 1000;
+  gens = 10;
+  branching = 3;
+  of_frac = 0.5;
+  name_len = 8;
+  ncycles = 0;
+  while ((c = getopt(argc, argv, "n:g:b:f:l:c:s:")) != -1) {
+    if (c == 'n') {
+      n = atoi(optarg);
+    } else if (c == 'g') {
+      gens = atoi(optarg);
+    } else if (c == 'b') {
+      branching = atoi(optarg);
+    } else if (c == 'f') {
+      of_frac = atof(optarg);
+    } else if (c == 'l') {
+      name_len = atoi(optarg);
+    } else if (c == 'c') {
+      ncycles = atoi(optarg);
+    } else if (c == 's') {
+      Seed = strtoull(optarg, NULL, 10) * 2654435761ULL + 1;
+    } else {
+      fprintf(stderr, "usage: famgen [-n people] [-g generations] [-b branching] [-f of_fraction]\n");
+      fprintf(stderr, "              [-l name_length] [-c cycles] [-s seed]\n");
+      exit(1);
+    }
+  }
+  if (n < 1 || gens < 1 || gens > n || branching < 1 || name_len < 1 || ncycles < 0) {
+    fprintf(stderr, "famgen: bad parameters\n");
+    exit(1);
+  }
+
+  /* Split the people into generations, and give each a couple from the
+     generation before. Only about size/branching couples are used, so each
+     has about branching children. */
+
+  father = malloc(sizeof(int)*n);
+  mother = malloc(sizeof(int)*n);
+  of_link = malloc(sizeof(int)*n);
+  gen_start = malloc(sizeof(int)*(gens+1));
+  for (g = 0; g <= gens; g++) gen_start[g] = (int) ((long long) n * g / gens);
+
+  for (g = 0; g < gens; g++) {
+    size = gen_start[g+1] - gen_start[g];
+    prev = (g == 0) ? 0 : gen_start[g-1];
+    prev_size = (g == 0) ? 0 : gen_start[g] - prev;
+    ncouples = prev_size / 2;
+    if (ncouples > (size + branching - 1) / branching) ncouples = (size + branching - 1) / branching;
+    for (i = 0; i < size; i++) {
+      p = gen_start[g] + i;
+      father[p] = mother[p] = -1;
+      of_link[p] = 0;
+      if (ncouples == 0) continue;
+      k = (int) (Random() % ncouples);
+      father[p] = prev + 2*k;
+      mother[p] = prev + 2*k + 1;
+      if (Chance(of_frac)) of_link[p] |= 1;
+      if (Chance(of_frac)) of_link[p] |= 2;
+    }
+  }
+
+  /* Close the cycles: pick a man below the first generation, follow his
+     fathers back to the first generation, and make that man his son. */
+
+  cyc_father = malloc(sizeof(int)*n);
+  for (i = 0; i < n; i++) cyc_father[i] = -1;
+  for (j = 0; j < ncycles && gens > 1; j++) {
+    g = 1 + (int) (Random() % (gens - 1));
+    size = gen_start[g+1] - gen_start[g];
+    p = gen_start[g] + 2 * (int) (Random() % ((size + 1) / 2));
+    if (size == 0 || father[p] == -1) continue;
+    for (k = p; father[k] != -1; k = father[k]) ;
+    cyc_father[k] = p;
+  }
+
+  /* Each person's children, in the order the _OF lines will list them. */
+
+  kids_start = calloc(n+1, sizeof(int));
+  for (i = 0; i < n; i++) {
+    if (father[i] != -1 && (of_link[i] & 1)) kids_start[father[i]+1]++;
+    if (mother[i] != -1 && (of_link[i] & 2)) kids_start[mother[i]+1]++;
+  }
+  for (i = 0; i < n; i++) kids_start[i+1] += kids_start[i];
+  kids = malloc(sizeof(int)*(kids_start[n]+1));
+  for (i = 0; i < n; i++) {
+    if (father[i] != -1 && (of_link[i] & 1)) kids[kids_start[father[i]]++] = i;
+    if (mother[i] != -1 && (of_link[i] & 2)) kids[kids_start[mother[i]]++] = i;
+  }
+  for (i = n; i > 0; i--) kids_start[i] = kids_start[i-1];
+  kids_start[0] = 0;
+
+  names = malloc((size_t) n * name_len);
+  for (i = 0; i < n; i++) {
+    names[(size_t) i * name_len] = 'A' + Random() % 26;
+    for (j = 1; j < name_len; j++) names[(size_t) i * name_len + j] = 'a' + Random() % 26;
+  }
+
+  /* Shuffle the records (Fisher-Yates) and print them. */
+
+  perm = malloc(sizeof(int)*n);
+  for (i = 0; i < n; i++) perm[i] = i;
+  for (i = n - 1; i > 0; i--) {
+    j = (int) (Random() % (i + 1));
+    tmp = perm[i];
+    perm[i] = perm[j];
+    perm[j] = tmp;
+  }
+
+  for (i = 0; i < n; i++) {
+    p = perm[i];
+    g = 0;
+    while (gen_start[g+1] <= p) g++;
+
+    printf("PERSON ");
+    PrintName(names, name_len, p);
+    printf("SEX %c\n", ((p - gen_start[g]) % 2 == 0) ? 'M' : 'F');
+    if (father[p] != -1 && !(of_link[p] & 1)) {
+      printf("FATHER ");
+      PrintName(names, name_len, father[p]);
+    }
+    if (mother[p] != -1 && !(of_link[p] & 2)) {
+      printf("MOTHER ");
+      PrintName(names, name_len, mother[p]);
+    }
+    if (cyc_father[p] != -1) {
+      printf("FATHER ");
+      PrintName(names, name_len, cyc_father[p]);
+    }
+    for (k = kids_start[p]; k < kids_start[p+1]; k++) {
+      printf(((p - gen_start[g]) % 2 == 0) ? "FATHER_OF " : "MOTHER_OF ");
+      PrintName(names, name_len, kids[k]);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "famtree.h"
+
+/* famparse.c
+   Riley Crockett
+
+   This lexes famtree input, and parses it with several threads for -j. The
+   whole input is read into one writable buffer (see ReadInput), and LexLine
+   splits lines in place, so no field is ever copied out.
+
+   For -j, the buffer is split
+   into chunks that each start on a PERSON line, so no chunk needs an overlying
+   person from the chunk before it. Worker threads tokenize their chunk and give
+   every name a chunk-local ID. The merge then walks the chunks in order, maps
+   local IDs to global ones (in first-seen order, just like get_line would), and
+   replays each line through SetSex and CreateLink. That keeps error checking
+   sequential, so the same first offending line is reported.
+   */
+
+/* One parsed line: its line number within the chunk, its REL_ code, and the
+   chunk-local ID of the person it names. For SEX lines, who is the sex. */
+
+typedef struct op {
+  int line;
+  int rel;
+  int who;
+} Op;
+
+/* This struct defines a chunk of the input and what its worker found in it. */
+
+typedef struct chunk {
+  char *start;
+  char *end;
+  FamTree *local;   /* The names in this chunk, with chunk-local IDs. */
+  Op *ops;
+  int nops;
+  int ops_cap;
+  int nlines;       /* The number of lines in the chunk. */
+} Chunk;
+
+/* @name: IsBlank
+   @brief: Checks for a field separator (whitespace other than a newline).
+   @param[in] c: The character.
+   @return: Returns 1 if c separates fields, otherwise 0. */
+
+int IsBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* @name: LexKeyword
+   @brief: Maps a keyword that is not NUL-terminated to its REL_ code. The
+           keywords differ in length or first letter, so one switch picks the
+           only candidate and a single compare confirms it.
+   @param[in] w: The keyword.
+   @param[in] len: The keyword's length.
+   @return: Returns the code. */
+
+int LexKeyword(const char *w, int len) {
+  switch (len) {
+    case 3:
+      return (!memcmp(w, "SEX", 3)) ? REL_SEX : REL_OTHER;
+    case 6:
+      if (w[0] == 'P') return (!memcmp(w, "PERSON", 6)) ? REL_PERSON : REL_OTHER;
+      if (w[0] == 'F') return (!memcmp(w, "FATHER", 6)) ? REL_FATHER : REL_OTHER;
+      if (w[0] == 'M') return (!memcmp(w, "MOTHER", 6)) ? REL_MOTHER : REL_OTHER;
+      return REL_OTHER;
+    case 9:
+      if (w[0] == 'F') return (!memcmp(w, "FATHER_OF", 9)) ? REL_FATHER_OF : REL_OTHER;
+      if (w[0] == 'M') return (!memcmp(w, "MOTHER_OF", 9)) ? REL_MOTHER_OF : REL_OTHER;
+      return REL_OTHER;
+  }
+  return REL_OTHER;
+}
+
+/* @name: IsPersonLine
+   @brief: Checks whether the line starting at s is a PERSON line with a name.
+   @param[in] s: The start of the line.
+   @param[in] end: The end of the input.
+   @return: Returns 1 if it is, otherwise 0. */
+
+int IsPersonLine(const char *s, const char *end) {
+  while (s < end && IsBlank(*s)) s++;
+  if (end - s < 7 || memcmp(s, "PERSON", 6) || !IsBlank(s[6])) return 0;
+  for (s += 7; s < end && *s != '\n'; s++) if (!IsBlank(*s)) return 1;
+  return 0;
+}
+
+/* @name: NextPersonLine
+   @brief: Finds the first PERSON line that starts at or after s.
+   @param[in] s: Where to start looking.
+   @param[in] begin: The start of the input.
+   @param[in] end: The end of the input.
+   @return: Returns the start of that line, or end if there is none. */
+
+const char *NextPersonLine(const char *s, const char *begin, const char *end) {
+  if (s > begin && s[-1] != '\n') {
+    s = memchr(s, '\n', end - s);
+    if (s == NULL) return end;
+    s++;
+  }
+  while (s < end) {
+    if (IsPersonLine(s, end)) return s;
+    s = memchr(s, '\n', end - s);
+    if (s == NULL) return end;
+    s++;
+  }
+  return end;
+}
+
+/* @name: AddOp
+   @brief: Appends a parsed line to a chunk.
+   @param[in] c: The chunk.
+   @param[in] line, rel, who: The line's fields. */
+
+void AddOp(Chunk *c, int line, int rel, int who) {
+  if (c->nops == c->ops_cap) {
+    c->ops_cap = (c->ops_cap == 0) ? 1024 : c->ops_cap * 2;
+    c->ops = realloc(c->ops, sizeof(Op)*c->ops_cap);
+  }
+  c->ops[c->nops].line = line;
+  c->ops[c->nops].rel = rel;
+  c->ops[c->nops].who = who;
+  c->nops++;
+}
+
+/* @name: LexLine
+   @brief: Splits one line into fields the same way get_line does, without
+           copying them out. The keyword is classified, and the rest of the
+           fields are slid left over the line so they are joined with single
+           spaces. l->name then points at the joined name inside the line. It
+           is not NUL-terminated, since the line may be the last in a mapping.
+   @param[in] s: The start of the line. It is overwritten.
+   @param[in] eol: The end of the line (its newline, or the end of the input).
+   @param[out] l: The line. */
+
+void LexLine(char *s, char *eol, Line *l) {
+  char *w, *kw, *d;
+  int kw_len;
+
+  while (s < eol && IsBlank(*s)) s++;
+  kw = s;
+  while (s < eol && !IsBlank(*s)) s++;
+  kw_len = s - kw;
+  l->rel = LexKeyword(kw, kw_len);
+  l->nfields = (kw_len > 0) ? 1 : 0;
+
+  while (s < eol && IsBlank(*s)) s++;
+  l->name = s;
+  l->fw_len = 0;
+  d = s;
+  while (s < eol) {
+    w = s;
+    while (s < eol && !IsBlank(*s)) s++;
+    if (l->nfields == 1) l->fw_len = s - w;
+    if (l->nfields > 1) *d++ = ' ';
+    if (d != w) memmove(d, w, s - w);
+    d += s - w;
+    l->nfields++;
+    while (s < eol && IsBlank(*s)) s++;
+  }
+  l->len = d - l->name;
+}
+
+/* @name: ReadInput
+   @brief: Gets the whole input into one writable buffer. A regular file is
+           mapped privately, so LexLine's writes never reach the file; anything
+           else (a pipe or a terminal) is read into memory.
+   @param[in] file: The input file, or NULL for standard input.
+   @param[out] in: The buffer. */
+
+void ReadInput(char *file, Input *in) {
+  struct stat st;
+  ssize_t got;
+  size_t cap;
+  int fd;
+
+  fd = (file == NULL) ? 0 : open(file, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) { perror(file); exit(1); }
+
+  in->mapped = 0;
+  in->size = 0;
+  in->buf = NULL;
+  if (S_ISREG(st.st_mode)) {
+    in->size = st.st_size;
+    if (in->size > 0) {
+      in->buf = mmap(NULL, in->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (in->buf == MAP_FAILED) { perror("mmap"); exit(1); }
+      madvise(in->buf, in->size, MADV_SEQUENTIAL);
+      in->mapped = 1;
+    }
+  } else {
+    cap = 0;
+    while (1) {
+      if (in->size == cap) {
+        cap = (cap == 0) ? 65536 : cap * 2;
+        in->buf = realloc(in->buf, cap);
+      }
+      got = read(fd, in->buf + in->size, cap - in->size);
+      if (got < 0) { perror("read"); exit(1); }
+      if (got == 0) break;
+      in->size += got;
+    }
+  }
+  if (fd != 0) close(fd);
+}
+
+/* @name: FreeInput
+   @brief: Frees a buffer from ReadInput.
+   @param[in] in: The buffer. */
+
+void FreeInput(Input *in) {
+  if (in->mapped) {
+    munmap(in->buf, in->size);
+  } else {
+    free(in->buf);
+  }
+}
+
+/* @name: ParseChunk
+   @brief: The start routine of pthread_create for the workers. This splits
+           each line of a chunk and records it as an Op.
+   @param[in] arg: The chunk. */
+
+void *ParseChunk(void *arg) {
+  Chunk *c = (Chunk *) arg;
+  char *s, *eol;
+  Line l;
+  int line, seen_person;
+
+  c->local = NewFamTree();
+  line = 0;
+  seen_person = 0;
+
+  for (s = c->start; s < c->end; s = eol + 1) {
+    eol = memchr(s, '\n', c->end - s);
+    if (eol == NULL) eol = c->end;
+    line++;
+
+    LexLine(s, eol, &l);
+    if (l.nfields <= 1) continue;
+
+    /* Lines before the first PERSON have nobody to attach to. Only the
+       first chunk can have them, since every other one starts on a PERSON. */
+
+    if (!seen_person && l.rel != REL_PERSON) continue;
+    if (l.rel == REL_PERSON) seen_person = 1;
+
+    if (l.rel == REL_SEX) {
+      if (l.fw_len == 1 && l.name[0] == 'F') AddOp(c, line, l.rel, FEMALE);
+      if (l.fw_len == 1 && l.name[0] == 'M') AddOp(c, line, l.rel, MALE);
+    } else {
+      AddOp(c, line, l.rel, GetPerson(c->local, l.name, l.len));
+    }
+  }
+  c->nlines = line;
+  return NULL;
+}
+
+/* @name: ParseMapped
+   @brief: Reads the input and parses it with nthreads workers, then merges
+           their results into the tree in input order.
+   @param[in] t: The tree to fill.
+   @param[in] file: The input file, or NULL for standard input.
+   @param[in] nthreads: The number of worker threads. */
+
+void ParseMapped(FamTree *t, char *file, int nthreads) {
+  int i, k, op, line;
+  int *map;
+  Input in;
+  char *begin, *end, *split;
+  Chunk *chunks;
+  Chunk *c;
+  pthread_t *tids;
+  char *started;
+
+  ReadInput(file, &in);
+  if (in.size == 0) {
+    FreeInput(&in);
+    return;
+  }
+  begin = in.buf;
+  end = begin + in.size;
+
+  /* Split the input into nthreads roughly equal chunks, moving each split
+     forward to the next PERSON line. Some chunks may end up empty. */
+
+  chunks = calloc(nthreads, sizeof(Chunk));
+  for (k = 0; k < nthreads; k++) {
+    if (k == 0) {
+      chunks[k].start = begin;
+    } else {
+      split = begin + (in.size / nthreads) * k;
+      if (split < chunks[k-1].start) split = chunks[k-1].start;
+      chunks[k].start = (char *) NextPersonLine(split, begin, end);
+      chunks[k-1].end = chunks[k].start;
+    }
+  }
+  chunks[nthreads-1].end = end;
+
+  /* A chunk whose thread can't be started is parsed on this one instead. */
+
+  tids = malloc(sizeof(pthread_t)*nthreads);
+  started = malloc(nthreads);
+  for (k = 0; k < nthreads; k++) {
+    started[k] = (pthread_create(&tids[k], NULL, ParseChunk, chunks+k) == 0);
+    if (!started[k]) ParseChunk(chunks+k);
+  }
+  for (k = 0; k < nthreads; k++) {
+    if (started[k]) pthread_join(tids[k], NULL);
+  }
+  free(tids);
+  free(started);
+
+  /* Merge the chunks in order. Error checking happens here, one line at a time. */
+
+  op = -1;
+  line = 0;
+  for (k = 0; k < nthreads; k++) {
+    c = chunks+k;
+    map = malloc(sizeof(int)*(c->local->n+1));
+    for (i = 0; i < c->local->n; i++) {
+      map[i] = GetPerson(t, c->local->name[i], strlen(c->local->name[i]));
+    }
+
+    for (i = 0; i < c->nops; i++) {
+      if (c->ops[i].rel == REL_PERSON) op = map[c->ops[i].who];
+      if (c->ops[i].rel == REL_SEX) {
+        SetSex(t, line + c->ops[i].line, op, c->ops[i].who);
+      } else {
+        CreateLink(t, line + c->ops[i].line, c->ops[i].rel, op, map[c->ops[i].who]);
+      }
+    }
+    line += c->nlines;
+
+    free(map);
+    free(c->ops);
+    FreeFamTree(c->local);
+  }
+
+  free(chunks);
+  FreeInput(&in);
+}
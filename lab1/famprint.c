@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "famtree.h"
+
+/* famprint.c
+   Riley Crockett
+
+   This prints the tree without stdio. Records are formatted into large buffers
+   with plain memcpy appends and written to standard output with write(). Once
+   the print order is known, every record can be formatted on its own, so with
+   -j the order is cut into nthreads slices: each thread formats one slice into
+   its own buffer, and the buffers are then written in slice order. Slices are
+   capped at PRINT_SLICE records to bound the buffers, so only very big trees
+   take more than one round of threads.
+   The output is byte for byte what PrintRecord would print.
+   */
+
+/* The most records a thread formats per round. */
+
+#define PRINT_SLICE 262144
+
+/* Written out once a serial buffer holds this many bytes. */
+
+#define PRINT_FLUSH (1 << 20)
+
+/* Appends a string literal, whose length is known at compile time. */
+
+#define PutLit(b, s) Put(b, s, sizeof(s) - 1)
+
+/* This struct defines one thread's share of a round. */
+
+typedef struct slice {
+  FamTree *t;
+  const int *order;   /* The records to format, in print order. */
+  int n;
+  OutBuf out;
+} Slice;
+
+/* @name: Put
+   @brief: Appends bytes to an output buffer, growing it if needed.
+   @param[in] b: The buffer.
+   @param[in] s: The bytes.
+   @param[in] len: The number of bytes. */
+
+void Put(OutBuf *b, const char *s, size_t len) {
+  if (b->len + len > b->cap) {
+    b->cap = (b->len + len > 2 * b->cap) ? b->len + len : 2 * b->cap;
+    b->buf = realloc(b->buf, b->cap);
+  }
+  memcpy(b->buf + b->len, s, len);
+  b->len += len;
+}
+
+/* @name: PutStr
+   @brief: Appends a NUL-terminated string to an output buffer.
+   @param[in] b: The buffer.
+   @param[in] s: The string. */
+
+void PutStr(OutBuf *b, const char *s) {
+  Put(b, s, strlen(s));
+}
+
+/* @name: FormatRecord
+   @brief: Appends a person's name, sex, parents, and children to a buffer.
+   @param[in] b: The buffer.
+   @param[in] t: The tree.
+   @param[in] p: The person.
+   @param[in] kids: The person's children, in print order.
+   @param[in] nkids: The number of children. */
+
+void FormatRecord(OutBuf *b, FamTree *t, int p, const int *kids, int nkids) {
+  int i;
+
+  PutStr(b, t->name[p]);
+  PutLit(b, "\n  Sex: ");
+  PutStr(b, SexNames[t->sex[p]]);
+  PutLit(b, "\n  Father: ");
+  PutStr(b, (t->father[p] == -1) ? "Unknown" : t->name[t->father[p]]);
+  PutLit(b, "\n  Mother: ");
+  PutStr(b, (t->mother[p] == -1) ? "Unknown" : t->name[t->mother[p]]);
+  if (nkids == 0) {
+    PutLit(b, "\n  Children: None\n\n");
+    return;
+  }
+  PutLit(b, "\n  Children:\n");
+  for (i = 0; i < nkids; i++) {
+    PutLit(b, "    ");
+    PutStr(b, t->name[kids[i]]);
+    PutLit(b, "\n");
+  }
+  PutLit(b, "\n");
+}
+
+/* @name: WriteAll
+   @brief: Writes a buffer to a file descriptor, retrying short writes, and empties it.
+   @param[in] fd: The file descriptor.
+   @param[in] b: The buffer. */
+
+void WriteAll(int fd, OutBuf *b) {
+  size_t off;
+  ssize_t w;
+
+  for (off = 0; off < b->len; off += w) {
+    w = write(fd, b->buf + off, b->len - off);
+    if (w < 0 && errno == EINTR) {
+      w = 0;
+    } else if (w < 0) {
+      perror("write");
+      exit(1);
+    }
+  }
+  b->len = 0;
+}
+
+/* @name: FormatSlice
+   @brief: The start routine of pthread_create for the printers. This formats
+           one slice of the print order into the slice's buffer.
+   @param[in] arg: The slice. */
+
+void *FormatSlice(void *arg) {
+  Slice *sl = (Slice *) arg;
+  FamTree *t = sl->t;
+  int i, p;
+
+  for (i = 0; i < sl->n; i++) {
+    p = sl->order[i];
+    FormatRecord(&sl->out, t, p, t->children + t->child_start[p], t->child_start[p+1] - t->child_start[p]);
+  }
+  return NULL;
+}
+
+/* @name: PrintTree
+   @brief: Prints everyone in print order to standard output.
+   @param[in] t: The tree, after BuildChildren.
+   @param[in] order: The print order.
+   @param[in] nthreads: The number of formatting threads, or 0 to format on this one. */
+
+void PrintTree(FamTree *t, int *order, int nthreads) {
+  Slice *slices;
+  OutBuf out;
+  int i, k, next, p, size;
+  pthread_t *tids;
+  char *started;
+
+  if (nthreads <= 1) {
+    memset(&out, 0, sizeof(OutBuf));
+    for (i = 0; i < t->n; i++) {
+      p = order[i];
+      FormatRecord(&out, t, p, t->children + t->child_start[p], t->child_start[p+1] - t->child_start[p]);
+      if (out.len >= PRINT_FLUSH) WriteAll(1, &out);
+    }
+    WriteAll(1, &out);
+    free(out.buf);
+    return;
+  }
+
+  /* A slice whose thread can't be started is formatted on this one instead. */
+
+  size = (t->n + nthreads - 1) / nthreads;
+  if (size > PRINT_SLICE) size = PRINT_SLICE;
+  slices = calloc(nthreads, sizeof(Slice));
+  tids = malloc(sizeof(pthread_t)*nthreads);
+  started = malloc(nthreads);
+  for (next = 0; next < t->n; ) {
+    for (k = 0; k < nthreads; k++) {
+      slices[k].t = t;
+      slices[k].order = order + next;
+      slices[k].n = (t->n - next < size) ? t->n - next : size;
+      next += slices[k].n;
+      started[k] = (pthread_create(&tids[k], NULL, FormatSlice, slices+k) == 0);
+      if (!started[k]) FormatSlice(slices+k);
+    }
+    for (k = 0; k < nthreads; k++) {
+      if (started[k]) pthread_join(tids[k], NULL);
+      WriteAll(1, &slices[k].out);
+    }
+  }
+  for (k = 0; k < nthreads; k++) free(slices[k].out.buf);
+  free(slices);
+  free(tids);
+  free(started);
+}
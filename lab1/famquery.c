@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fields.h"
+#include "famtree.h"
+
+/* famquery.c
+   Riley Crockett
+
+   This answers ancestry queries about a validated family tree. Queries are read
+   from standard input, one per line:
+
+     ANCESTOR name | name     Is the first person an ancestor of the second?
+     COMMON name | name       The nearest common ancestors of two people.
+     DESCENDANTS k name       Everyone at most k generations below a person.
+
+   ANCESTOR is answered from a reachability index built once over the tree:
+     - rank: each person's position in the print order. An ancestor always
+       comes first.
+     - anc: a 64-bit Bloom filter of each person's ancestors. Every person sets
+       one bit, and it flows down every parent link, so merges in the DAG are
+       never missed (a clear bit means "not an ancestor").
+     - Two interval labelings from depth-first traversals that visit children in
+       opposite orders (GRAIL-style). low is the smallest post number below a
+       person, so a descendant's [low, post] always nests inside an ancestor's.
+     - The first traversal's pre/post numbers, which are exact for descendants
+       along the traversal's spanning tree.
+   Most queries are settled by those in constant time. The rest fall back to a
+   depth-first search from the ancestor that skips anyone the labels rule out.
+   */
+
+/* This struct defines the reachability index, plus the scratch space that
+   queries use. A person is marked during a query when mark[p] == stamp, so
+   the marks never have to be cleared. */
+
+typedef struct reachindex {
+  int *rank;
+  unsigned long long *anc;
+  int *pre;
+  int *post;
+  int *low;
+  int *post2;
+  int *low2;
+  int *parent_start;      /* Parents in CSR form, the reverse of the children. */
+  int *parents;
+
+  int *mark;
+  int *mark2;
+  int stamp;
+  int *stack;
+  int *depth;
+} ReachIndex;
+
+/* @name: PersonBit
+   @brief: Picks the Bloom filter bit for a person.
+   @param[in] p: The person.
+   @return: Returns the bit. */
+
+unsigned long long PersonBit(int p) {
+  return 1ULL << (((unsigned int) p * 2654435761u) >> 26);
+}
+
+/* @name: Label
+   @brief: Numbers everyone with an iterative depth-first traversal, starting
+           from each person in print order who has not been reached yet.
+   @param[in] t: The tree.
+   @param[in] order: The print order.
+   @param[in] reverse: Is 1 to visit each person's children last to first.
+   @param[out] pre: Pre-order numbers, or NULL if they are not needed.
+   @param[out] post: Post-order numbers.
+   @param[out] low: The smallest post number at or below each person.
+   @param[in] stack, next: Scratch arrays of t->n ints. */
+
+void Label(FamTree *t, int *order, int reverse, int *pre, int *post, int *low, int *stack, int *next) {
+  int i, r, p, c, sp, npre, npost, deg;
+
+  for (i = 0; i < t->n; i++) post[i] = -1;
+  for (i = 0; i < t->n; i++) next[i] = -1;
+  npre = 0;
+  npost = 0;
+
+  for (r = 0; r < t->n; r++) {
+    if (next[order[r]] != -1) continue;
+    sp = 0;
+    stack[sp++] = order[r];
+    next[order[r]] = 0;
+    if (pre != NULL) pre[order[r]] = npre++;
+
+    while (sp > 0) {
+      p = stack[sp-1];
+      deg = t->child_start[p+1] - t->child_start[p];
+      if (next[p] < deg) {
+        c = reverse ? t->children[t->child_start[p+1] - 1 - next[p]] : t->children[t->child_start[p] + next[p]];
+        next[p]++;
+        if (next[c] == -1) {
+          next[c] = 0;
+          if (pre != NULL) pre[c] = npre++;
+          stack[sp++] = c;
+        }
+      } else {
+        /* Every child has finished (the tree has no cycles), so low can be taken from them. */
+        sp--;
+        post[p] = npost++;
+        low[p] = post[p];
+        for (i = t->child_start[p]; i < t->child_start[p+1]; i++) {
+          if (low[t->children[i]] < low[p]) low[p] = low[t->children[i]];
+        }
+      }
+    }
+  }
+}
+
+/* @name: BuildIndex
+   @brief: Builds the reachability index. This is O(V+E).
+   @param[in] t: The tree.
+   @param[in] order: The print order.
+   @return: Returns the index. */
+
+ReachIndex *BuildIndex(FamTree *t, int *order) {
+  ReachIndex *ri;
+  int i, j, p;
+
+  ri = malloc(sizeof(ReachIndex));
+  ri->rank = malloc(sizeof(int)*(t->n+1));
+  ri->anc = malloc(sizeof(unsigned long long)*(t->n+1));
+  ri->pre = malloc(sizeof(int)*(t->n+1));
+  ri->post = malloc(sizeof(int)*(t->n+1));
+  ri->low = malloc(sizeof(int)*(t->n+1));
+  ri->post2 = malloc(sizeof(int)*(t->n+1));
+  ri->low2 = malloc(sizeof(int)*(t->n+1));
+  ri->mark = calloc(t->n+1, sizeof(int));
+  ri->mark2 = calloc(t->n+1, sizeof(int));
+  ri->stamp = 0;
+  ri->stack = malloc(sizeof(int)*(t->n+1));
+  ri->depth = malloc(sizeof(int)*(t->n+1));
+
+  for (i = 0; i < t->n; i++) {
+    ri->rank[order[i]] = i;
+    ri->anc[order[i]] = PersonBit(order[i]);
+  }
+  for (i = 0; i < t->n; i++) {
+    p = order[i];
+    for (j = t->child_start[p]; j < t->child_start[p+1]; j++) ri->anc[t->children[j]] |= ri->anc[p];
+  }
+
+  Label(t, order, 0, ri->pre, ri->post, ri->low, ri->stack, ri->depth);
+  Label(t, order, 1, NULL, ri->post2, ri->low2, ri->stack, ri->depth);
+
+  InvertChildren(t, &ri->parent_start, &ri->parents);
+  return ri;
+}
+
+/* @name: MayReach
+   @brief: Applies the constant-time cuts.
+   @param[in] ri: The index.
+   @param[in] a, b: Two different people.
+   @return: Returns 0 if b is certainly not a descendant of a, otherwise 1. */
+
+int MayReach(ReachIndex *ri, int a, int b) {
+  if (ri->rank[a] >= ri->rank[b]) return 0;
+  if ((ri->anc[b] & PersonBit(a)) == 0) return 0;
+  if (ri->low[b] < ri->low[a] || ri->post[b] > ri->post[a]) return 0;
+  if (ri->low2[b] < ri->low2[a] || ri->post2[b] > ri->post2[a]) return 0;
+  return 1;
+}
+
+/* @name: TreeReach
+   @brief: Checks whether b is below a on the first traversal's spanning tree.
+   @param[in] ri: The index.
+   @param[in] a, b: Two people.
+   @return: Returns 1 if it is (so b is certainly a descendant), otherwise 0. */
+
+int TreeReach(ReachIndex *ri, int a, int b) {
+  return ri->pre[a] <= ri->pre[b] && ri->post[b] <= ri->post[a];
+}
+
+/* @name: IsAncestor
+   @brief: Determines whether a is an ancestor of b.
+   @param[in] t: The tree.
+   @param[in] ri: The index.
+   @param[in] a, b: Two people.
+   @return: Returns 1 if a is an ancestor of b, otherwise 0. */
+
+int IsAncestor(FamTree *t, ReachIndex *ri, int a, int b) {
+  int i, p, c, sp;
+
+  if (a == b || !MayReach(ri, a, b)) return 0;
+  if (TreeReach(ri, a, b)) return 1;
+
+  /* Fall back to a search that only enters people who may still reach b. */
+
+  ri->stamp++;
+  sp = 0;
+  ri->stack[sp++] = a;
+  while (sp > 0) {
+    p = ri->stack[--sp];
+    for (i = t->child_start[p]; i < t->child_start[p+1]; i++) {
+      c = t->children[i];
+      if (c == b) return 1;
+      if (ri->mark[c] == ri->stamp) continue;
+      ri->mark[c] = ri->stamp;
+      if (!MayReach(ri, c, b)) continue;
+      if (TreeReach(ri, c, b)) return 1;
+      ri->stack[sp++] = c;
+    }
+  }
+  return 0;
+}
+
+/* The index whose print order CompareRanks sorts by. */
+ReachIndex *SortIndex;
+
+/* @name: CompareRanks
+   @brief: A qsort comparison function that orders person IDs by print order.
+   @param[in] a, b: Pointers to the IDs.
+   @return: Returns a negative, zero or positive number. */
+
+int CompareRanks(const void *a, const void *b) {
+  return SortIndex->rank[*(int *) a] - SortIndex->rank[*(int *) b];
+}
+
+/* @name: MarkAncestors
+   @brief: Marks a person and all of their ancestors, walking up the parents.
+   @param[in] ri: The index.
+   @param[in] p: The person.
+   @param[in] mark: The mark array to use.
+   @param[in] stamp: The value to mark with.
+   @param[out] out: If not NULL, gets everyone marked.
+   @return: Returns the number of people marked. */
+
+int MarkAncestors(ReachIndex *ri, int p, int *mark, int stamp, int *out) {
+  int i, head, tail;
+
+  tail = 0;
+  ri->stack[tail++] = p;
+  mark[p] = stamp;
+  for (head = 0; head < tail; head++) {
+    p = ri->stack[head];
+    for (i = ri->parent_start[p]; i < ri->parent_start[p+1]; i++) {
+      if (mark[ri->parents[i]] == stamp) continue;
+      mark[ri->parents[i]] = stamp;
+      ri->stack[tail++] = ri->parents[i];
+    }
+  }
+  if (out != NULL) memcpy(out, ri->stack, sizeof(int)*tail);
+  return tail;
+}
+
+/* @name: CommonAncestors
+   @brief: Finds the nearest common ancestors of two people. A person counts as
+           their own ancestor here, so if a is b's ancestor the answer is a.
+           A common ancestor is nearest when none of their children is also a
+           common ancestor (if a descendant of theirs were, so would the child
+           on the way down to them).
+   @param[in] t: The tree.
+   @param[in] ri: The index.
+   @param[in] a, b: Two people.
+   @param[out] out: Room for t->n IDs; gets the answer in print order.
+   @return: Returns the number of nearest common ancestors. */
+
+int CommonAncestors(FamTree *t, ReachIndex *ri, int a, int b, int *out) {
+  int i, j, n, ncommon, stamp_a, stamp_c, nearest;
+  int *common;
+
+  stamp_a = ++ri->stamp;
+  MarkAncestors(ri, a, ri->mark, stamp_a, NULL);
+
+  /* Everyone above b who is also above a is a common ancestor. Give them a
+     second stamp in mark2 so they can be told apart in one lookup. */
+
+  common = malloc(sizeof(int)*(t->n+1));
+  n = MarkAncestors(ri, b, ri->mark2, ++ri->stamp, common);
+  stamp_c = ++ri->stamp;
+  ncommon = 0;
+  for (i = 0; i < n; i++) {
+    if (ri->mark[common[i]] == stamp_a) {
+      common[ncommon++] = common[i];
+      ri->mark2[common[i]] = stamp_c;
+    }
+  }
+
+  n = 0;
+  for (i = 0; i < ncommon; i++) {
+    nearest = 1;
+    for (j = t->child_start[common[i]]; j < t->child_start[common[i]+1]; j++) {
+      if (ri->mark2[t->children[j]] == stamp_c) { nearest = 0; break; }
+    }
+    if (nearest) out[n++] = common[i];
+  }
+  free(common);
+
+  SortIndex = ri;
+  qsort(out, n, sizeof(int), CompareRanks);
+  return n;
+}
+
+/* @name: Descendants
+   @brief: Finds everyone at most k generations below a person, nearest first.
+   @param[in] t: The tree.
+   @param[in] ri: The index.
+   @param[in] p: The person.
+   @param[in] k: The number of generations.
+   @param[out] out: Room for t->n IDs; gets the answer.
+   @return: Returns the number of descendants found. */
+
+int Descendants(FamTree *t, ReachIndex *ri, int p, int k, int *out) {
+  int i, c, head, tail;
+
+  ri->stamp++;
+  ri->mark[p] = ri->stamp;
+  ri->depth[p] = 0;
+  ri->stack[0] = p;
+  tail = 1;
+  for (head = 0; head < tail; head++) {
+    p = ri->stack[head];
+    if (ri->depth[p] == k) continue;
+    for (i = t->child_start[p]; i < t->child_start[p+1]; i++) {
+      c = t->children[i];
+      if (ri->mark[c] == ri->stamp) continue;
+      ri->mark[c] = ri->stamp;
+      ri->depth[c] = ri->depth[p] + 1;
+      ri->stack[tail++] = c;
+    }
+  }
+  memcpy(out, ri->stack + 1, sizeof(int)*(tail-1));
+  return tail-1;
+}
+
+/* @name: JoinName
+   @brief: Joins fields [from, to) of a line with single spaces.
+   @param[in] is: The input struct.
+   @param[in] from, to: The fields to join.
+   @param[out] name: A buffer of MAXLEN characters.
+   @return: Returns the length of the name. */
+
+int JoinName(IS is, int from, int to, char *name) {
+  int i, len;
+
+  len = 0;
+  for (i = from; i < to; i++) {
+    if (i > from) name[len++] = ' ';
+    strcpy(name+len, is->fields[i]);
+    len += strlen(is->fields[i]);
+  }
+  name[len] = '\0';
+  return len;
+}
+
+/* @name: LookUp
+   @brief: Finds a person named in a query, and says so if there is nobody by that name.
+   @param[in] t: The tree.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @return: Returns the person's ID, or -1. */
+
+int LookUp(FamTree *t, char *name, int len) {
+  int p;
+
+  p = FindPerson(t, name, len);
+  if (p == -1) printf("Unknown person: %s\n", name);
+  return p;
+}
+
+/* @name: PrintList
+   @brief: Prints a list of people below a heading, the way PrintPerson prints children.
+   @param[in] t: The tree.
+   @param[in] people: The people.
+   @param[in] n: The number of people. */
+
+void PrintList(FamTree *t, int *people, int n) {
+  int i;
+
+  if (n == 0) {
+    printf(" None\n");
+    return;
+  }
+  printf("\n");
+  for (i = 0; i < n; i++) printf("    %s\n", t->name[people[i]]);
+}
+
+/* @name: RunQueries
+   @brief: Builds the reachability index, then answers queries from standard
+           input until EOF. Malformed queries are reported and skipped.
+   @param[in] t: The tree.
+   @param[in] order: The print order. */
+
+void RunQueries(FamTree *t, int *order) {
+  ReachIndex *ri;
+  IS is;
+  int i, bar, k, a, b, n;
+  int *out;
+  char a_name[MAXLEN], b_name[MAXLEN];
+
+  ri = BuildIndex(t, order);
+  out = malloc(sizeof(int)*(t->n+1));
+  is = new_inputstruct(NULL);
+  if (is == NULL) exit(1);
+
+  while (get_line(is) >= 0) {
+    if (is->NF == 0) continue;
+
+    if (!strcmp(is->fields[0], "ANCESTOR") || !strcmp(is->fields[0], "COMMON")) {
+      bar = -1;
+      for (i = 1; i < is->NF; i++) if (!strcmp(is->fields[i], "|")) bar = i;
+      if (bar <= 1 || bar == is->NF-1) {
+        fprintf(stderr, "Bad query on line %d\n", is->line);
+        continue;
+      }
+      a = LookUp(t, a_name, JoinName(is, 1, bar, a_name));
+      b = LookUp(t, b_name, JoinName(is, bar+1, is->NF, b_name));
+      if (a == -1 || b == -1) continue;
+
+      if (is->fields[0][0] == 'A') {
+        printf("%s %s an ancestor of %s\n", a_name, IsAncestor(t, ri, a, b) ? "is" : "is not", b_name);
+      } else {
+        n = CommonAncestors(t, ri, a, b, out);
+        printf("Nearest common ancestors of %s and %s:", a_name, b_name);
+        PrintList(t, out, n);
+      }
+    } else if (!strcmp(is->fields[0], "DESCENDANTS") && is->NF >= 3) {
+      k = atoi(is->fields[1]);
+      if (k < 0 || strspn(is->fields[1], "0123456789") != strlen(is->fields[1])) {
+        fprintf(stderr, "Bad query on line %d\n", is->line);
+        continue;
+      }
+      a = LookUp(t, a_name, JoinName(is, 2, is->NF, a_name));
+      if (a == -1) continue;
+      n = Descendants(t, ri, a, k, out);
+      printf("Descendants of %s (up to %d generations):", a_name, k);
+      PrintList(t, out, n);
+    } else {
+      fprintf(stderr, "Bad query on line %d\n", is->line);
+    }
+  }
+
+  jettison_inputstruct(is);
+  free(out);
+}
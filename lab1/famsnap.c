@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "famtree.h"
+
+/* famsnap.c
+   Riley Crockett
+
+   This writes and loads binary snapshots of a validated family tree. A snapshot
+   holds everything famtree computes from its input: names, sexes, parent IDs,
+   the CSR children arrays, the name index, and the print order. Loading maps
+   the file and points the tree's arrays straight into it, so a snapshot can be
+   printed or queried without parsing or validating anything again.
+
+   Layout (native byte order; every section starts on an 8-byte boundary):
+     SnapHeader
+     name_off[n]          (long long, offset of each name in the name blob)
+     names                (names_size bytes of NUL-terminated names)
+     sex[n]               (unsigned char)
+     father[n], mother[n] (int)
+     child_start[n+1]     (int)
+     children[nchildren]  (int)
+     order[n]             (int)
+     slots[nslots]        (Slot)
+   */
+
+#define SNAP_MAGIC "FAMSNAP"
+#define SNAP_VERSION 1
+#define SNAP_BYTE_ORDER 0x01020304
+
+/* This struct defines the start of a snapshot file. */
+
+typedef struct snapheader {
+  char magic[8];
+  unsigned int version;
+  unsigned int byte_order;  /* SNAP_BYTE_ORDER as written by the snapshot's machine. */
+  int n;
+  int nchildren;
+  unsigned int nslots;
+  unsigned int pad;
+  long long names_size;
+} SnapHeader;
+
+/* @name: Align8
+   @brief: Rounds a size up to a multiple of 8.
+   @param[in] size: The size.
+   @return: Returns the rounded size. */
+
+size_t Align8(size_t size) {
+  return (size + 7) & ~(size_t) 7;
+}
+
+/* @name: WriteSection
+   @brief: Writes one section of a snapshot, padded out to 8 bytes.
+   @param[in] f: The snapshot stream.
+   @param[in] data: The section, or NULL if it was already written and only needs padding.
+   @param[in] size: The section's size in bytes. */
+
+void WriteSection(FILE *f, const void *data, size_t size) {
+  static const char zeros[8] = { 0 };
+
+  if (data != NULL && size > 0) fwrite(data, 1, size, f);
+  fwrite(zeros, 1, Align8(size) - size, f);
+}
+
+/* @name: WriteSnapshot
+   @brief: Writes a snapshot of a validated tree. It is written to file.tmp and
+           then renamed, so readers never see a partial snapshot.
+   @param[in] t: The tree, after BuildChildren.
+   @param[in] order: The print order from TopoOrder.
+   @param[in] file: The snapshot's file name. */
+
+void WriteSnapshot(FamTree *t, int *order, char *file) {
+  FILE *f;
+  SnapHeader h;
+  long long *name_off;
+  char *tmp;
+  int i;
+
+  memset(&h, 0, sizeof(SnapHeader));
+  strcpy(h.magic, SNAP_MAGIC);
+  h.version = SNAP_VERSION;
+  h.byte_order = SNAP_BYTE_ORDER;
+  h.n = t->n;
+  h.nchildren = t->child_start[t->n];
+  h.nslots = t->nslots;
+
+  name_off = malloc(sizeof(long long)*(t->n+1));
+  h.names_size = 0;
+  for (i = 0; i < t->n; i++) {
+    name_off[i] = h.names_size;
+    h.names_size += strlen(t->name[i]) + 1;
+  }
+
+  tmp = malloc(strlen(file) + 5);
+  sprintf(tmp, "%s.tmp", file);
+  f = fopen(tmp, "w");
+  if (f == NULL) { perror(tmp); exit(1); }
+
+  WriteSection(f, &h, sizeof(SnapHeader));
+  WriteSection(f, name_off, sizeof(long long)*t->n);
+  for (i = 0; i < t->n; i++) fwrite(t->name[i], 1, strlen(t->name[i]) + 1, f);
+  WriteSection(f, NULL, h.names_size);
+  WriteSection(f, t->sex, sizeof(unsigned char)*t->n);
+  WriteSection(f, t->father, sizeof(int)*t->n);
+  WriteSection(f, t->mother, sizeof(int)*t->n);
+  WriteSection(f, t->child_start, sizeof(int)*(t->n+1));
+  WriteSection(f, t->children, sizeof(int)*h.nchildren);
+  WriteSection(f, order, sizeof(int)*t->n);
+  WriteSection(f, t->slots, sizeof(Slot)*t->nslots);
+
+  if (ferror(f) || fclose(f) != 0 || rename(tmp, file) < 0) {
+    perror(file);
+    exit(1);
+  }
+  free(tmp);
+  free(name_off);
+}
+
+/* @name: CheckSnapshot
+   @brief: Checks that every offset and id in a mapped snapshot is in range,
+           so a damaged file is an error rather than a read out of bounds.
+   @param[in] h: The header, whose section sizes have been checked.
+   @param[in] name_off, names: The name offsets and the name blob.
+   @param[in] t: The tree built on the map.
+   @param[in] order: The print order.
+   @return: Returns 1 if the snapshot is sound, else 0. */
+
+int CheckSnapshot(SnapHeader *h, long long *name_off, char *names, FamTree *t, int *order) {
+  char *seen;
+  int i, ok;
+  unsigned int j, empty;
+
+  if (h->n > 0 && (h->names_size == 0 || names[h->names_size-1] != '\0')) return 0;
+  if (t->child_start[0] != 0 || t->child_start[h->n] != h->nchildren) return 0;
+  for (i = 0; i < h->n; i++) {
+    if (name_off[i] < 0 || name_off[i] >= h->names_size) return 0;
+    if (t->sex[i] > FEMALE) return 0;
+    if (t->father[i] < -1 || t->father[i] >= h->n) return 0;
+    if (t->mother[i] < -1 || t->mother[i] >= h->n) return 0;
+    if (t->child_start[i+1] < t->child_start[i]) return 0;
+  }
+  for (i = 0; i < h->nchildren; i++) {
+    if (t->children[i] < 0 || t->children[i] >= h->n) return 0;
+  }
+
+  /* The order must name everyone exactly once. */
+
+  seen = calloc(h->n + 1, 1);
+  ok = 1;
+  for (i = 0; i < h->n && ok; i++) {
+    if (order[i] < 0 || order[i] >= h->n || seen[order[i]]) ok = 0;
+    else seen[order[i]] = 1;
+  }
+  free(seen);
+  if (!ok) return 0;
+
+  /* Probes stop at an empty slot, so there must be one. */
+
+  if (h->nslots == 0 || (h->nslots & (h->nslots - 1)) != 0) return 0;
+  empty = 0;
+  for (j = 0; j < h->nslots; j++) {
+    if (t->slots[j].id < -1 || t->slots[j].id >= h->n) return 0;
+    if (t->slots[j].id == -1) empty++;
+  }
+  return empty > 0;
+}
+
+/* @name: LoadSnapshot
+   @brief: Maps a snapshot and builds a read-only tree on top of it. Only the
+           name pointers are computed; every other array points into the map.
+   @param[in] file: The snapshot's file name.
+   @param[out] order: Set to the snapshot's print order.
+   @return: Returns the tree. */
+
+FamTree *LoadSnapshot(char *file, int **order) {
+  FamTree *t;
+  SnapHeader *h;
+  struct stat st;
+  char *map, *s, *names;
+  long long *name_off;
+  size_t size;
+  int fd, i;
+
+  fd = open(file, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) { perror(file); exit(1); }
+  if ((size_t) st.st_size < sizeof(SnapHeader)) {
+    fprintf(stderr, "famtree: %s: not a snapshot\n", file);
+    exit(1);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) { perror("mmap"); exit(1); }
+  close(fd);
+
+  h = (SnapHeader *) map;
+  if (memcmp(h->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) || h->byte_order != SNAP_BYTE_ORDER) {
+    fprintf(stderr, "famtree: %s: not a snapshot\n", file);
+    exit(1);
+  }
+  if (h->version != SNAP_VERSION) {
+    fprintf(stderr, "famtree: %s: snapshot version %u, expected %d\n", file, h->version, SNAP_VERSION);
+    exit(1);
+  }
+
+  /* Make sure the sections the header describes are all there. */
+
+  if (h->n < 0 || h->nchildren < 0 || h->names_size < 0) {
+    fprintf(stderr, "famtree: %s: corrupt snapshot\n", file);
+    exit(1);
+  }
+  size = Align8(sizeof(SnapHeader)) + Align8(sizeof(long long)*h->n) + Align8(h->names_size)
+       + Align8(h->n) + 2*Align8(sizeof(int)*h->n) + Align8(sizeof(int)*(h->n+1))
+       + Align8(sizeof(int)*h->nchildren) + Align8(sizeof(int)*h->n) + Align8(sizeof(Slot)*h->nslots);
+  if (size != (size_t) st.st_size) {
+    fprintf(stderr, "famtree: %s: truncated snapshot\n", file);
+    exit(1);
+  }
+
+  t = malloc(sizeof(FamTree));
+  memset(t, 0, sizeof(FamTree));
+  t->map = map;
+  t->map_size = st.st_size;
+  t->n = t->cap = h->n;
+
+  s = map + Align8(sizeof(SnapHeader));
+  name_off = (long long *) s;              s += Align8(sizeof(long long)*h->n);
+  names = s;                               s += Align8(h->names_size);
+  t->sex = (unsigned char *) s;            s += Align8(h->n);
+  t->father = (int *) s;                   s += Align8(sizeof(int)*h->n);
+  t->mother = (int *) s;                   s += Align8(sizeof(int)*h->n);
+  t->child_start = (int *) s;              s += Align8(sizeof(int)*(h->n+1));
+  t->children = (int *) s;                 s += Align8(sizeof(int)*h->nchildren);
+  *order = (int *) s;                      s += Align8(sizeof(int)*h->n);
+  t->slots = (Slot *) s;
+  t->nslots = h->nslots;
+  if (!CheckSnapshot(h, name_off, names, t, *order)) {
+    fprintf(stderr, "famtree: %s: corrupt snapshot\n", file);
+    exit(1);
+  }
+
+  t->name = malloc(sizeof(char *)*(h->n+1));
+  for (i = 0; i < h->n; i++) t->name[i] = names + name_off[i];
+  return t;
+}
@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
-#include "fields.h"
-#include "jrb.h"
-#include "dllist.h"
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "famtree.h"
 
 /* famtree.c
    Riley Crockett
@@ -10,239 +12,675 @@
 
    This program reads people from standard input, stores them, establishes/error checks 
    their relationships, and then reprints their complete information.
+
+   Usage: famtree [-T] [-q | -d | -s socket] [-j threads] [-w snapshot] [file]
+          famtree [-T] [-q | -d | -s socket] -r snapshot
+   With -j, the input is parsed, and the output formatted, by that many threads
+   (see famparse.c and famprint.c). -w also writes a binary snapshot of the
+   validated tree, and -r prints from one instead of reading input (see
+   famsnap.c). -q answers ancestry queries from standard
+   input instead of printing everyone (see famquery.c). -d keeps the tree in
+   memory and applies edits to it from standard input, and -s does the same for
+   clients of a Unix socket (see famdaemon.c). -T reports how long each phase
+   took, and the peak memory use, on standard error. Parsing includes the
+   per-line sex and parent checks; validating is the cycle check.
    */
 
-/* This struct defines a 'Person'. A person has strings to store their name and sex, 
-   pointers to their parents, a list of children pointers, a visited field for DFS, 
-   and a printed field for printing with BFS. */
+/* -j is cut down to this many threads; more would only cost memory. */
+#define MAX_THREADS 256
+
+/* The strings printed for each sex. */
+
+const char *SexNames[] = { "Unknown", "Male", "Female" };
+
+/* @name: ArenaAlloc
+   @brief: Carves size bytes out of the arena, starting a new block if needed.
+   @param[in] a: The arena.
+   @param[in] size: The number of bytes.
+   @param[in] align: The alignment of the returned pointer (a power of two).
+   @return: Returns the memory. */
+
+void *ArenaAlloc(Arena *a, size_t size, size_t align) {
+  char *mem;
+  char *block;
+  size_t bsize;
+
+  mem = (char *) (((size_t) a->next + align - 1) & ~(align - 1));
+  if (a->next == NULL || mem + size > a->end) {
+    /* Each block starts with a pointer to the previous one, so ArenaFree can find them. */
+    bsize = (size + align + sizeof(char *) > ARENA_BLOCK) ? size + align + sizeof(char *) : ARENA_BLOCK;
+    block = malloc(bsize);
+    if (block == NULL) { perror("malloc"); exit(1); }
+    *(char **) block = a->blocks;
+    a->blocks = block;
+    a->next = block + sizeof(char *);
+    a->end = block + bsize;
+    mem = (char *) (((size_t) a->next + align - 1) & ~(align - 1));
+  }
+  a->next = mem + size;
+  return mem;
+}
+
+/* @name: ArenaFree
+   @brief: Frees every block in the arena.
+   @param[in] a: The arena. */
+
+void ArenaFree(Arena *a) {
+  char *block;
+
+  while (a->blocks != NULL) {
+    block = a->blocks;
+    a->blocks = *(char **) block;
+    free(block);
+  }
+  a->next = NULL;
+  a->end = NULL;
+}
+
+/* @name: HashName
+   @brief: Hashes a name with 32-bit FNV-1a.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @return: Returns the hash. */
+
+unsigned int HashName(const char *name, int len) {
+  unsigned int h = 2166136261u;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* @name: NewFamTree
+   @brief: Allocates an empty family tree.
+   @return: Returns the tree. */
+
+FamTree *NewFamTree() {
+  FamTree *t;
+
+  t = malloc(sizeof(FamTree));
+  t->n = 0;
+  t->cap = 1024;
+  t->name = malloc(sizeof(char *)*t->cap);
+  t->sex = malloc(sizeof(unsigned char)*t->cap);
+  t->father = malloc(sizeof(int)*t->cap);
+  t->mother = malloc(sizeof(int)*t->cap);
+  t->nlinks = 0;
+  t->links_cap = 1024;
+  t->links = malloc(sizeof(Link)*t->links_cap);
+  t->child_start = NULL;
+  t->children = NULL;
+  t->nslots = 2048;
+  t->slots = malloc(sizeof(Slot)*t->nslots);
+  memset(t->slots, 0xff, sizeof(Slot)*t->nslots);
+  t->arena.blocks = NULL;
+  t->arena.next = NULL;
+  t->arena.end = NULL;
+  t->map = NULL;
+  t->map_size = 0;
+  return t;
+}
+
+/* @name: FreeFamTree
+   @brief: Frees a tree and all of its names.
+   @param[in] t: The tree. */
+
+void FreeFamTree(FamTree *t) {
+  if (t->map != NULL) {
+    free(t->name);
+    munmap(t->map, t->map_size);
+    free(t);
+    return;
+  }
+  free(t->name);
+  free(t->sex);
+  free(t->father);
+  free(t->mother);
+  free(t->links);
+  free(t->child_start);
+  free(t->children);
+  free(t->slots);
+  ArenaFree(&t->arena);
+  free(t);
+}
+
+/* @name: GrowSlots
+   @brief: Doubles the number of name slots and re-inserts everyone, using the cached hashes.
+   @param[in] t: The tree. */
+
+void GrowSlots(FamTree *t) {
+  Slot *old;
+  unsigned int old_nslots, i, j;
+
+  old = t->slots;
+  old_nslots = t->nslots;
+  t->nslots *= 2;
+  t->slots = malloc(sizeof(Slot)*t->nslots);
+  memset(t->slots, 0xff, sizeof(Slot)*t->nslots);
+  for (i = 0; i < old_nslots; i++) {
+    if (old[i].id < 0) continue;
+    for (j = old[i].hash & (t->nslots - 1); t->slots[j].id >= 0; j = (j + 1) & (t->nslots - 1)) ;
+    t->slots[j] = old[i];
+  }
+  free(old);
+}
+
+/* @name: FindSlot
+   @brief: Probes the name index for a name.
+   @param[in] t: The tree.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @param[in] h: The name's hash.
+   @return: Returns the index of the name's slot, or of the empty slot where it would go. */
+
+unsigned int FindSlot(FamTree *t, const char *name, int len, unsigned int h) {
+  unsigned int i;
+  int id;
+
+  for (i = h & (t->nslots - 1); t->slots[i].id >= 0; i = (i + 1) & (t->nslots - 1)) {
+    id = t->slots[i].id;
+    if (t->slots[i].hash == h && !strncmp(t->name[id], name, len) && t->name[id][len] == '\0') break;
+  }
+  return i;
+}
+
+/* @name: FindPerson
+   @brief: Finds a person by name without adding them. This also works on a
+           tree loaded from a snapshot.
+   @param[in] t: The tree.
+   @param[in] name: The person's name.
+   @param[in] len: The length of the name.
+   @return: Returns the person's ID, or -1 if they are not in the tree. */
+
+int FindPerson(FamTree *t, const char *name, int len) {
+  return t->slots[FindSlot(t, name, len, HashName(name, len))].id;
+}
+
+/* @name: GetPerson
+   @brief: Finds a person by name, giving them the next ID if they are not in the tree yet.
+   @param[in] t: The tree.
+   @param[in] name: The person's name (it need not stay valid after the call).
+   @param[in] len: The length of the name.
+   @return: Returns the person's ID. */
+
+int GetPerson(FamTree *t, const char *name, int len) {
+  unsigned int h, i;
+  int id;
+
+  h = HashName(name, len);
+  i = FindSlot(t, name, len, h);
+  if (t->slots[i].id >= 0) return t->slots[i].id;
+
+  if (t->n == t->cap) {
+    t->cap *= 2;
+    t->name = realloc(t->name, sizeof(char *)*t->cap);
+    t->sex = realloc(t->sex, sizeof(unsigned char)*t->cap);
+    t->father = realloc(t->father, sizeof(int)*t->cap);
+    t->mother = realloc(t->mother, sizeof(int)*t->cap);
+  }
+  id = t->n++;
+  t->name[id] = ArenaAlloc(&t->arena, len+1, 1);
+  memcpy(t->name[id], name, len);
+  t->name[id][len] = '\0';
+  t->sex[id] = UNKNOWN;
+  t->father[id] = -1;
+  t->mother[id] = -1;
+
+  t->slots[i].hash = h;
+  t->slots[i].id = id;
+
+  /* Keep the load factor at or below one half. */
+  if ((unsigned int) t->n * 2 > t->nslots) GrowSlots(t);
+  return id;
+}
+
+/* @name: TruncatePeople
+   @brief: Removes everyone whose ID is n or more, newest first. Emptying the
+           newest slots first leaves every older probe chain intact, as long as
+           the index has not grown since they were added. If it has, the index
+           is rebuilt instead. Their names stay in the arena.
+   @param[in] t: The tree.
+   @param[in] n: The number of people to keep.
+   @param[in] nslots: The number of slots the index had when person n was added. */
+
+void TruncatePeople(FamTree *t, int n, unsigned int nslots) {
+  unsigned int i, j;
+  int id;
+
+  if (nslots == t->nslots) {
+    while (t->n > n) {
+      id = t->n - 1;
+      i = FindSlot(t, t->name[id], strlen(t->name[id]), HashName(t->name[id], strlen(t->name[id])));
+      t->slots[i].id = -1;
+      t->n--;
+    }
+    return;
+  }
+
+  t->n = n;
+  memset(t->slots, 0xff, sizeof(Slot)*t->nslots);
+  for (id = 0; id < n; id++) {
+    j = HashName(t->name[id], strlen(t->name[id]));
+    for (i = j & (t->nslots - 1); t->slots[i].id >= 0; i = (i + 1) & (t->nslots - 1)) ;
+    t->slots[i].hash = j;
+    t->slots[i].id = id;
+  }
+}
+
+/* @name: AddLink
+   @brief: Records that child is one of parent's children.
+   @param[in] t: The tree.
+   @param[in] parent, child: The two person IDs. */
+
+void AddLink(FamTree *t, int parent, int child) {
+  if (t->nlinks == t->links_cap) {
+    t->links_cap *= 2;
+    t->links = realloc(t->links, sizeof(Link)*t->links_cap);
+  }
+  t->links[t->nlinks].parent = parent;
+  t->links[t->nlinks].child = child;
+  t->nlinks++;
+}
+
+/* The messages printed for each LINK_ error, followed by the line number. */
+
+const char *LinkErrors[] = {
+  "",
+  "Bad input - sex mismatch on line",
+  "Bad input -- child with two mothers on line",
+  "Bad input -- child with two fathers on line"
+};
+
+/* @name: LinkFail
+   @brief: Prints a link error and exits.
+   @param[in] err: The LINK_ error.
+   @param[in] line: The line number where the error occurs. */
+
+void LinkFail(int err, int line) {
+  fprintf(stderr, "%s %d\n", LinkErrors[err], line);
+  exit(1);
+}
+
+/* @name: CheckSex
+   @brief: Error checks a SEX line against what a person's relationships already imply.
+   @param[in] t: The tree.
+   @param[in] op: The overlying person.
+   @param[in] sex: MALE or FEMALE.
+   @return: Returns LINK_OK, or LINK_SEX on a mismatch. */
+
+int CheckSex(FamTree *t, int op, int sex) {
+  if (t->sex[op] != UNKNOWN && t->sex[op] != sex) return LINK_SEX;
+  return LINK_OK;
+}
+
+/* @name: SetSex
+   @brief: Sets a person's sex from a SEX line, exiting if it is a mismatch.
+   @param[in] t: The tree.
+   @param[in] line: The line number where the error occurs.
+   @param[in] op: The overlying person.
+   @param[in] sex: MALE or FEMALE. */
 
-typedef struct person {
-  char *name;
-  char *sex;
-  struct person *father;
-  struct person *mother;
-  Dllist children;
-  int visited;
-  int printed;
-} Person;
+void SetSex(FamTree *t, int line, int op, int sex) {
+  int err;
+
+  if ((err = CheckSex(t, op, sex)) != LINK_OK) LinkFail(err, line);
+  t->sex[op] = sex;
+}
+
+/* @name: CheckLink
+   @brief: Error checks sex and parent assignments for a link, without making it.
+   @param[in] t: The tree.
+   @param[in] rel: The relationship between the two people (a REL_ code). 
+   @param[in] op: The overlying person in the relationship. 
+   @param[in] p: The current person.
+   @return: Returns LINK_OK, or the LINK_ error the link would cause. */
+
+int CheckLink(FamTree *t, int rel, int op, int p) {
+  if (rel == REL_MOTHER_OF && t->sex[op] == MALE) return LINK_SEX;
+  if (rel == REL_FATHER_OF && t->sex[op] == FEMALE) return LINK_SEX;
+  if (rel == REL_MOTHER) {
+    if (t->mother[op] != -1) return LINK_TWO_MOTHERS;
+    if (t->sex[p] == MALE) return LINK_SEX;
+  }
+  if (rel == REL_FATHER && t->father[op] != -1) return LINK_TWO_FATHERS;
+  return LINK_OK;
+}
 
 /* @name: CreateLink 
    @brief: Creates a link between two people based on their relationship. 
-           It also error checks sex and parent assignments. 
+           It exits if CheckLink finds an error.
+   @param[in] t: The tree.
    @param[in] line: The line number where the error occurs. 
-   @param[in] rel: The relationship between the two people. 
+   @param[in] rel: The relationship between the two people (a REL_ code). 
    @param[in] op: The overlying person in the relationship. 
    @param[in] p: The current person. */
 
-void CreateLink(int line, char *rel, Person *op, Person *p) {
-  if (!strcmp(rel, "MOTHER_OF")) {
-    if (!strcmp(op->sex, "Male")) {
-      fprintf(stderr, "%s %d\n", "Bad input - sex mismatch on line", line);
-      exit(1);
-    }
-    p->mother = op;
-    strcpy(op->sex, "Female");
+void CreateLink(FamTree *t, int line, int rel, int op, int p) {
+  int err;
+
+  if ((err = CheckLink(t, rel, op, p)) != LINK_OK) LinkFail(err, line);
+  if (rel == REL_MOTHER_OF) {
+    t->mother[p] = op;
+    t->sex[op] = FEMALE;
   }
-  if (!strcmp(rel, "FATHER_OF")) {
-    if (strcmp(op->sex, "Female") == 0) {
-      fprintf(stderr, "%s %d\n", "Bad input - sex mismatch on line", line);
-      exit(1);
-    }
-    p->father = op;
-    strcpy(op->sex, "Male");
-  }
-  if (!strcmp(rel, "MOTHER")) {
-    if (op->mother == NULL) {
-      if (!strcmp(p->sex, "Male")) {
-        fprintf(stderr, "%s %d\n", "Bad input - sex mismatch on line", line);
-        exit(1);
-      }
-      op->mother = p;
-      strcpy(p->sex, "Female");
-    } 
-	else {
-      fprintf(stderr, "%s %d\n", "Bad input -- child with two mothers on line", line);
-      exit(1);
-    }
+  if (rel == REL_FATHER_OF) {
+    t->father[p] = op;
+    t->sex[op] = MALE;
   }
-  if (!strcmp(rel, "FATHER")) {
-    if (op->father == NULL) {
-      op->father = p;
-      strcpy(p->sex, "Male");
-    }
-    else {
-      fprintf(stderr, "%s %d\n", "Bad input -- child with two fathers on line", line);
-      exit(1);
-    }
+  if (rel == REL_MOTHER) {
+    t->mother[op] = p;
+    t->sex[p] = FEMALE;
   }
-  if (!strcmp(rel, "MOTHER_OF") || !strcmp(rel, "FATHER_OF")) {
-    dll_append(op->children, new_jval_v((void *) p));
+  if (rel == REL_FATHER) {
+    t->father[op] = p;
+    t->sex[p] = MALE;
   }
-  if (!strcmp(rel, "MOTHER") || !strcmp(rel, "FATHER")) {
-    dll_append(p->children, new_jval_v((void *) op));
-  } 
+  if (rel == REL_MOTHER_OF || rel == REL_FATHER_OF) AddLink(t, op, p);
+  if (rel == REL_MOTHER || rel == REL_FATHER) AddLink(t, p, op);
 }
 
-/* @name: PrintPerson
-   @brief: Prints a person's name, sex, parents, and children.
-   @param[in] p: The person to print */
+/* @name: BuildChildren
+   @brief: Packs the link list into the CSR children arrays with a counting sort.
+           The sort is stable, so each person's children keep the order their
+           links were read in.
+   @param[in] t: The tree. */
 
-void PrintPerson(Person *p) {
-  Dllist dt;
-  Person *c;
+void BuildChildren(FamTree *t) {
+  int i, *next;
 
-  printf("%s\n  Sex: %s\n", p->name, p->sex);
-  printf("  Father: ");
-  (p->father == NULL) ? printf("Unknown\n") : printf("%s\n", p->father->name);
-  printf("  Mother: ");
-  (p->mother == NULL) ? printf("Unknown\n") : printf("%s\n", p->mother->name);
-  printf("  Children:");
-  if (dll_empty(p->children)) {
-	printf(" None\n\n"); 
-	return;
-  }
-  printf("\n");
-  dll_traverse(dt, p->children) {
-    c = (Person *) dt->val.v;
-    printf("    %s\n", c->name);
+  t->child_start = calloc(t->n+1, sizeof(int));
+  t->children = malloc(sizeof(int)*(t->nlinks+1));
+  for (i = 0; i < t->nlinks; i++) t->child_start[t->links[i].parent+1]++;
+  for (i = 0; i < t->n; i++) t->child_start[i+1] += t->child_start[i];
+
+  next = malloc(sizeof(int)*(t->n+1));
+  memcpy(next, t->child_start, sizeof(int)*t->n);
+  for (i = 0; i < t->nlinks; i++) t->children[next[t->links[i].parent]++] = t->links[i].child;
+  free(next);
+
+  free(t->links);
+  t->links = NULL;
+  t->nlinks = t->links_cap = 0;
+}
+
+/* @name: InvertChildren
+   @brief: Builds everyone's parents in CSR form, the reverse of the children arrays.
+   @param[in] t: The tree, after BuildChildren.
+   @param[out] parent_start: Set to the n+1 offsets.
+   @param[out] parents: Set to the parent IDs. */
+
+void InvertChildren(FamTree *t, int **parent_start, int **parents) {
+  int i, p, nchildren, *start, *next;
+
+  nchildren = t->child_start[t->n];
+  start = calloc(t->n+1, sizeof(int));
+  *parents = malloc(sizeof(int)*(nchildren+1));
+  for (i = 0; i < nchildren; i++) start[t->children[i]+1]++;
+  for (i = 0; i < t->n; i++) start[i+1] += start[i];
+
+  next = malloc(sizeof(int)*(t->n+1));
+  memcpy(next, start, sizeof(int)*t->n);
+  for (p = 0; p < t->n; p++) {
+    for (i = t->child_start[p]; i < t->child_start[p+1]; i++) (*parents)[next[t->children[i]]++] = p;
   }
-  printf("\n");
+  free(next);
+  *parent_start = start;
+}
+
+/* @name: PrintRecord
+   @brief: Prints a person's name, sex, parents, and the given children.
+   @param[in] f: The stream to print on.
+   @param[in] t: The tree.
+   @param[in] p: The person to print.
+   @param[in] kids: The person's children.
+   @param[in] nkids: The number of children. */
+
+void PrintRecord(FILE *f, FamTree *t, int p, const int *kids, int nkids) {
+  OutBuf b;
+
+  memset(&b, 0, sizeof(OutBuf));
+  FormatRecord(&b, t, p, kids, nkids);
+  fwrite(b.buf, 1, b.len, f);
+  free(b.buf);
 }
 
-/* @name: Is_Descendant
-   @brief: Uses DFS to determine if a person is a descendant of themselves. 
-   @param[in] p: The person. 
-   @return: Returns 1 if a person is a descendant of themselves, otherwise returns 0. */
+/* The tree whose names CompareNames sorts by. */
+FamTree *SortTree;
 
-int Is_Descendant(Person *p) {
-  Dllist dt;
-  Person *c;
+/* @name: CompareNames
+   @brief: A qsort comparison function that orders person IDs by name in SortTree.
+   @param[in] a, b: Pointers to the IDs.
+   @return: Returns the strcmp of the two names. */
 
-  if (p->visited == 1) return 0;
-  if (p->visited == 2) return 1;
-  p->visited = 2;
-  dll_traverse(dt, p->children) {
-    c = (Person *) dt->val.v;
-	if (Is_Descendant(c)) return 1;
+int CompareNames(const void *a, const void *b) {
+  return strcmp(SortTree->name[*(int *) a], SortTree->name[*(int *) b]);
+}
+
+/* @name: TopoOrder
+   @brief: Orders people so that parents come before their children (Kahn's algorithm).
+           Each person's in-degree is the number of parent links into them. People with
+           no parents seed the queue in name order, and a child is queued once its last 
+           parent is dequeued, so nobody enters the queue twice and no recursion is needed.
+   @param[in] t: The tree, after BuildChildren.
+   @param[out] order: An array with room for every person, filled in print order.
+   @return: Returns the number of people ordered. If this is less than the number
+            of people, the rest are on (or below) a cycle. */
+
+int TopoOrder(FamTree *t, int *order) {
+  int *indegree;
+  int i, c, p, head, tail;
+
+  indegree = calloc(t->n+1, sizeof(int));
+  for (i = 0; i < t->child_start[t->n]; i++) indegree[t->children[i]]++;
+
+  tail = 0;
+  for (i = 0; i < t->n; i++) if (indegree[i] == 0) order[tail++] = i;
+  SortTree = t;
+  qsort(order, tail, sizeof(int), CompareNames);
+
+  /* The order array doubles as the queue: [head, tail) holds people whose
+     parents have all been placed. */
+
+  for (head = 0; head < tail; head++) {
+    p = order[head];
+    for (i = t->child_start[p]; i < t->child_start[p+1]; i++) {
+      c = t->children[i];
+      if (--indegree[c] == 0) order[tail++] = c;
+    }
   }
-  p->visited = 1;
-  return 0;
+  free(indegree);
+  return tail;
 }
 
-int main(int argc, char **argv) 
-{
-  Person *op;     /* The overlying person (Used to help link a person to their relatives) */
-  Person *p;      /* The current person */
-  JRB people;     /* A red/black tree to store person structs. */
-  JRB pn;         /* A person node to index people in the tree. */
-  Dllist pq;      /* A doubly-linked list to serve as a print queue. */
-  Dllist dt;      /* A dllist object for traversing doubly-linked lists. */
-  IS is;          /* An input struct to organize standard input. */
-  int i;
-  int name_len;   /* An integer for finding the length of a person's name. */
-  char *tmp;      /* A temporary string to hold a person's name. */
+/* @name: ReadTree
+   @brief: Reads people and their relationships one line at a time.
+   @param[in] t: The tree to fill.
+   @param[in] file: The input file, or NULL for standard input. */
 
-  is = new_inputstruct(NULL);
-  if (is == NULL) exit(1);
-  people = make_jrb();
-  pq = new_dllist();
+void ReadTree(FamTree *t, char *file) {
+  int op;        /* The overlying person (Used to help link a person to their relatives) */
+  int p;         /* The current person */
+  int line;      /* The current line number. */
+  Input in;      /* The whole input. */
+  Line l;        /* The current line, split into fields. */
+  char *s, *eol, *end;
 
-  while (get_line(is) >= 0) {
-	if (is->NF <= 1) continue;
+  ReadInput(file, &in);
+  op = -1;
+  line = 0;
+  end = in.buf + in.size;
 
-	if (strcmp(is->fields[0], "SEX")) {
-	  /* Find the person's name length to allocate a string, then store that name */
+  for (s = in.buf; s < end; s = eol + 1) {
+	eol = memchr(s, '\n', end - s);
+	if (eol == NULL) eol = end;
+	line++;
 
-	  name_len = 0;
-	  for (i = 1; i < is->NF; i++) name_len += strlen(is->fields[i])+1;	
-	  tmp = malloc(sizeof(char)*(name_len+1));
-	  strcpy(tmp, is->fields[1]);
-	  name_len = strlen(is->fields[1]);
+	LexLine(s, eol, &l);
+	if (l.nfields <= 1) continue;
 
-	  for (i = 2; i < is->NF; i++) {
-	    tmp[name_len] = ' ';
-		strcpy(tmp+name_len+1, is->fields[i]);
-		name_len += strlen(tmp+name_len);
-	  }
+	/* Lines before the first PERSON have nobody to attach to. */
+	if (op == -1 && l.rel != REL_PERSON) continue;
 
-	  pn = jrb_find_str(people, tmp);
+	if (l.rel != REL_SEX) {
+	  /* LexLine already joined the name's fields, so find (or create) that person. */
 
-	  /* If the person is not already in the tree, allocate/initialize their values, 
-	     then add them to the tree. Otherwise set a pointer to the existing person. */
+	  p = GetPerson(t, l.name, l.len);
 	  
-	  if (pn == NULL) {
-		p = malloc(sizeof(Person));
-		p->name = malloc(sizeof(char)*(name_len+1));
-		strcpy(p->name, tmp);
-		p->visited = 0;
-		p->printed = 0;
-		p->sex = malloc(sizeof(char)*(7));
-        strcpy(p->sex, "Unknown");
-		p->children = new_dllist();
-		jrb_insert_str(people, p->name, new_jval_v((void *) p));	    
-	  } 
-	  else { p = (Person *) pn->val.v; }
-	  
-	  if (!strcmp(is->fields[0], "PERSON")) op = p;
+	  if (l.rel == REL_PERSON) op = p;
 
 	  /* Create links between people based on their relationship */
 
-	  CreateLink(is->line, is->fields[0], op, p); 
+	  CreateLink(t, line, l.rel, op, p); 
 	}
 	else {
 	  /* When a person's sex is read, error check and set their sex */
 
-      if (!strcmp(is->fields[1], "F")) {
-	    if (!strcmp(op->sex, "Male")) {
-		  fprintf(stderr, "%s %d\n", "Bad input - sex mismatch on line", is->line);
-		  exit(1);
-		}
-		strcpy(op->sex, "Female");
-	  } 
-	  if (!strcmp(is->fields[1], "M")) {
-	    if (!strcmp(op->sex, "Female")) {
-          fprintf(stderr, "%s %d\n", "Bad input - sex mismatch on line", is->line);
-          exit(1);
-        }	
-		strcpy(op->sex, "Male");
-	  }
+      if (l.fw_len == 1 && l.name[0] == 'F') SetSex(t, line, op, FEMALE);
+	  if (l.fw_len == 1 && l.name[0] == 'M') SetSex(t, line, op, MALE);
 	}
 
   }
+  FreeInput(&in);
+}
 
-  /* After reading, traverse the tree. Check if a person is their 
-     own descendant, and insert people with no parents into a print queue. */
- 
-  jrb_traverse(pn, people) {
-	p = (Person *) pn->val.v;
-    if (Is_Descendant(p)) {
-	  fprintf(stderr, "Bad input -- cycle in specification\n");
+/* @name: Now
+   @brief: Reads the monotonic clock.
+   @return: Returns the time in seconds. */
+
+double Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* @name: Phase
+   @brief: For -T, reports how long a phase took, and starts timing the next one.
+   @param[in] timing: Is 1 if -T was given.
+   @param[in] name: The phase that just ended.
+   @param[in,out] start: When it started. Set to now. */
+
+void Phase(int timing, const char *name, double *start) {
+  double now;
+
+  if (!timing) return;
+  now = Now();
+  fprintf(stderr, "famtree: %-9s %10.6f s\n", name, now - *start);
+  *start = now;
+}
+
+int main(int argc, char **argv) 
+{
+  FamTree *t;    /* The family tree. */
+  int *order;    /* The people in print order (parents before children). */
+  int c;
+  int nthreads;  /* The number of parser threads, or 0 to read on this one. */
+  char *file;    /* The input file, or NULL for standard input. */
+  char *snap_in; /* A snapshot to load instead of reading input. */
+  char *snap_out;/* A snapshot to write after validating the input. */
+  int query;     /* Is 1 to answer queries from standard input instead of printing. */
+  int serve;     /* Is 1 to apply edits instead of printing. */
+  char *sock;    /* With serve, the socket to take edits on, or NULL for standard input. */
+  int timing;    /* Is 1 to report phase times and peak memory on standard error. */
+  double start;  /* When the current phase started. */
+  struct rusage ru;
+
+  nthreads = 0;
+  file = NULL;
+  snap_in = NULL;
+  snap_out = NULL;
+  query = 0;
+  serve = 0;
+  sock = NULL;
+  timing = 0;
+  while ((c = getopt(argc, argv, "dj:qr:s:Tw:")) != -1) {
+    if (c == 'j' && atoi(optarg) > 0) {
+	  nthreads = atoi(optarg);
+	  if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+	} else if (c == 'r') {
+	  snap_in = optarg;
+	} else if (c == 'w') {
+	  snap_out = optarg;
+	} else if (c == 'q') {
+	  query = 1;
+	} else if (c == 'd') {
+	  serve = 1;
+	} else if (c == 's') {
+	  serve = 1;
+	  sock = optarg;
+	} else if (c == 'T') {
+	  timing = 1;
+	} else {
+	  fprintf(stderr, "usage: famtree [-T] [-q | -d | -s socket] [-j threads] [-w snapshot] [file]\n");
+	  fprintf(stderr, "       famtree [-T] [-q | -d | -s socket] -r snapshot\n");
 	  exit(1);
 	}
-	if (p->mother == NULL && p->father == NULL) dll_append(pq, new_jval_v((void *) p));
-  }
-
-  /* Print out people in the queue using BFS. If a person's parents have been
-     printed (or are non-existent) and they have not been printed, print that 
-	 person and move their children to the back of the queue. */
-  
-  while (!dll_empty(pq)) {
-    p = (Person *) dll_first(pq)->val.v;
-	dll_delete_node(dll_first(pq));
-    
-	if (p->printed == 0) {
-	  if ((p->mother == NULL || p->mother->printed == 1) && (p->father == NULL || p->father->printed == 1)) {
-		PrintPerson(p);
-		p->printed = 1;
-		if (dll_empty(p->children)) continue;
-        
-		dll_traverse(dt, p->children) {
-		  op = (Person *) dt->val.v;
-		  dll_append(pq, new_jval_v((void *) op));
-		}
-	  }
-	}
+  }
+  if (optind < argc) file = argv[optind];
+  if (snap_in != NULL && (file != NULL || nthreads > 0 || snap_out != NULL)) {
+	fprintf(stderr, "famtree: -r cannot be combined with an input file, -j or -w\n");
+	exit(1);
+  }
+  if (query && snap_in == NULL && file == NULL) {
+	fprintf(stderr, "famtree: -q reads queries from standard input, so the tree must come from a file or -r\n");
+	exit(1);
+  }
+  if (query && serve) {
+	fprintf(stderr, "famtree: -q cannot be combined with -d or -s\n");
+	exit(1);
+  }
+  if (serve && sock == NULL && snap_in == NULL && file == NULL) {
+	fprintf(stderr, "famtree: -d reads edits from standard input, so the tree must come from a file or -r\n");
+	exit(1);
+  }
+
+  start = Now();
+  if (snap_in != NULL) {
+	/* A snapshot was validated when it was written, and holds its print order. */
+	t = LoadSnapshot(snap_in, &order);
+	Phase(timing, "load", &start);
+  } else {
+    t = NewFamTree();
+    if (nthreads > 0) {
+      ParseMapped(t, file, nthreads);
+    } else {
+      ReadTree(t, file);
+    }
+    Phase(timing, "parse", &start);
+
+    /* After reading, order everyone so parents come before children. If anyone
+       could not be ordered, somebody is their own descendant. */
+
+    BuildChildren(t);
+    order = malloc(sizeof(int)*(t->n+1));
+    if (TopoOrder(t, order) < t->n) {
+	  fprintf(stderr, "Bad input -- cycle in specification\n");
+	  exit(1);
+    }
+    Phase(timing, "validate", &start);
+    if (snap_out != NULL) {
+      WriteSnapshot(t, order, snap_out);
+      Phase(timing, "snapshot", &start);
+    }
+  }
+
+  if (query) {
+    RunQueries(t, order);
+    Phase(timing, "queries", &start);
+  } else if (serve) {
+    RunDaemon(t, order, sock);
+  } else {
+    PrintTree(t, order, nthreads);
+    Phase(timing, "print", &start);
+  }
+  if (timing) {
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "famtree: peak RSS  %10ld KB\n", ru.ru_maxrss);
   }
 
-  jettison_inputstruct(is);
+  if (t->map == NULL) free(order);
+  FreeFamTree(t);
 }
@@ -0,0 +1,147 @@
+#ifndef FAMTREE_H_
+#define FAMTREE_H_
+
+#include <stdio.h>
+
+/* famtree.h
+   Riley Crockett
+
+   The family tree shared by famtree.c (storage, linking and printing),
+   famparse.c (the lexer and the parallel parser), famprint.c (the bulk
+   writer), famsnap.c (binary snapshots), famquery.c (ancestry queries) and
+   famdaemon.c (incremental edits).
+   */
+
+/* A person's sex is stored in one byte. SexNames gives the string to print. */
+
+enum { UNKNOWN, MALE, FEMALE };
+extern const char *SexNames[];
+
+/* The keyword that starts an input line. REL_OTHER is any unrecognized keyword:
+   its name still creates a person, but no link is made. */
+
+enum { REL_OTHER, REL_PERSON, REL_SEX, REL_FATHER, REL_MOTHER, REL_FATHER_OF, REL_MOTHER_OF };
+
+/* The errors a link can cause. LinkErrors gives the message for each. */
+
+enum { LINK_OK, LINK_SEX, LINK_TWO_MOTHERS, LINK_TWO_FATHERS };
+extern const char *LinkErrors[];
+
+/* This struct defines a bump arena. Names are carved out of large blocks, 
+   and are never freed individually. */
+
+#define ARENA_BLOCK (1 << 20)
+
+typedef struct arena {
+  char *blocks;
+  char *next;
+  char *end;
+} Arena;
+
+/* A slot in the name index. It caches the name's hash so most probes never 
+   touch the name itself. An empty slot has an id of -1. */
+
+typedef struct slot {
+  unsigned int hash;
+  int id;
+} Slot;
+
+/* A parent-to-child link, recorded in the order links are made. */
+
+typedef struct link {
+  int parent;
+  int child;
+} Link;
+
+/* One input line, split into fields. nfields counts the keyword too. */
+
+typedef struct line {
+  int rel;          /* The keyword's REL_ code. */
+  int nfields;
+  char *name;       /* The fields after the keyword, joined with single spaces in
+                       the input buffer itself. It is not NUL-terminated. */
+  int len;
+  int fw_len;       /* The length of the first field after the keyword. */
+} Line;
+
+/* The whole input, in one writable buffer. */
+
+typedef struct input {
+  char *buf;
+  size_t size;
+  int mapped;       /* Is 1 if buf is a private mapping, 0 if it was malloced. */
+} Input;
+
+/* A growable output buffer. */
+
+typedef struct outbuf {
+  char *buf;
+  size_t len;
+  size_t cap;
+} OutBuf;
+
+/* This struct defines a family tree. Every person has a dense integer ID, and
+   their name, sex, father and mother live in parallel arrays indexed by that ID
+   (a missing parent is -1). While reading, links are appended to a flat list.
+   BuildChildren then packs them into compressed-sparse-row form: the children 
+   of person i are children[child_start[i]] up to children[child_start[i+1]]. 
+   Names are indexed by an open-addressing (linear probing) hash table. */
+
+typedef struct famtree {
+  int n;                  /* The number of people. */
+  int cap;                /* The allocated length of the per-person arrays. */
+  char **name;
+  unsigned char *sex;
+  int *father;
+  int *mother;
+
+  Link *links;
+  int nlinks;
+  int links_cap;
+  int *child_start;
+  int *children;
+
+  Slot *slots;
+  unsigned int nslots;    /* Always a power of two. */
+  Arena arena;
+
+  void *map;              /* For a tree loaded from a snapshot, the mapped file. */
+  size_t map_size;
+} FamTree;
+
+/* famtree.c */
+void *ArenaAlloc(Arena *a, size_t size, size_t align);
+void ArenaFree(Arena *a);
+FamTree *NewFamTree();
+void FreeFamTree(FamTree *t);
+int FindPerson(FamTree *t, const char *name, int len);
+int GetPerson(FamTree *t, const char *name, int len);
+void TruncatePeople(FamTree *t, int n, unsigned int nslots);
+int CheckSex(FamTree *t, int op, int sex);
+void SetSex(FamTree *t, int line, int op, int sex);
+int CheckLink(FamTree *t, int rel, int op, int p);
+void CreateLink(FamTree *t, int line, int rel, int op, int p);
+void InvertChildren(FamTree *t, int **parent_start, int **parents);
+void PrintRecord(FILE *f, FamTree *t, int p, const int *kids, int nkids);
+
+/* famparse.c */
+void LexLine(char *s, char *eol, Line *l);
+void ReadInput(char *file, Input *in);
+void FreeInput(Input *in);
+void ParseMapped(FamTree *t, char *file, int nthreads);
+
+/* famprint.c */
+void FormatRecord(OutBuf *b, FamTree *t, int p, const int *kids, int nkids);
+void PrintTree(FamTree *t, int *order, int nthreads);
+
+/* famsnap.c */
+void WriteSnapshot(FamTree *t, int *order, char *file);
+FamTree *LoadSnapshot(char *file, int **order);
+
+/* famquery.c */
+void RunQueries(FamTree *t, int *order);
+
+/* famdaemon.c */
+void RunDaemon(FamTree *t, int *order, char *path);
+
+#endif // FAMTREE_H_
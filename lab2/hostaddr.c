@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hostdb.h"
+
+/* hostaddr.c
+   Riley Crockett
+
+   This answers lookups by address instead of by name. HostDBBuildAddrs sorts
+   the IPs by address, and builds a compressed (path-compressed binary) radix
+   trie over the sorted array: a node only exists where two addresses first
+   differ, so there are fewer than two nodes per address. Every node keeps the
+   run of the array below it, so a prefix query stops at the first node
+   inside the block and returns that whole run without visiting its subtree.
+   */
+
+/* @name: AddrKey
+   @brief: Packs an IP's address into an integer, first byte highest.
+   @param[in] ip: The IP.
+   @return: Returns the key. */
+
+unsigned int AddrKey(IP *ip) {
+  return ((unsigned int) ip->address[0] << 24) | (ip->address[1] << 16) |
+         (ip->address[2] << 8) | ip->address[3];
+}
+
+/* @name: PrefixMask
+   @brief: Makes the mask of the top bits of an address.
+   @param[in] bits: The number of bits, from 0 to 32.
+   @return: Returns the mask. */
+
+unsigned int PrefixMask(int bits) {
+  return (bits == 0) ? 0 : ~0u << (32 - bits);
+}
+
+/* @name: BuildNode
+   @brief: Builds the subtrie of a run of the sorted IPs.
+   @param[in] db: The index. by_addr is sorted, and anodes has room.
+   @param[in] lo, hi: The run, which is not empty.
+   @return: Returns the node's index in db->anodes. */
+
+int BuildNode(HostDB *db, int lo, int hi) {
+  AddrNode *node;
+  unsigned int a, b, bit;
+  int n, l, h, m;
+
+  n = db->nanodes++;
+  node = &db->anodes[n];
+  a = AddrKey(db->by_addr[lo]);
+  b = AddrKey(db->by_addr[hi-1]);
+  node->bits = (a == b) ? 32 : __builtin_clz(a ^ b);
+  node->prefix = a & PrefixMask(node->bits);
+  node->lo = lo;
+  node->hi = hi;
+  node->child[0] = node->child[1] = -1;
+  if (node->bits == 32) return n;
+
+  /* Binary search for the first address with the split bit set. */
+
+  bit = 1u << (31 - node->bits);
+  l = lo;
+  h = hi - 1;
+  while (l < h) {
+    m = l + (h - l) / 2;
+    if (AddrKey(db->by_addr[m]) & bit) h = m; else l = m + 1;
+  }
+
+  /* anodes does not move, but node may not be used across the calls. */
+
+  m = BuildNode(db, lo, l);
+  db->anodes[n].child[0] = m;
+  m = BuildNode(db, l, hi);
+  db->anodes[n].child[1] = m;
+  return n;
+}
+
+/* @name: HostDBBuildAddrs
+   @brief: Sorts the index's IPs by address and builds the address trie.
+           Each IP is found once through the name lists (an IP with no names
+           is not in the index at all), then an LSD radix sort on the four
+           address bytes orders them. The sort is stable, so IPs with the
+           same address stay in the order they were read.
+   @param[in] db: The index, after its names are built. */
+
+void HostDBBuildAddrs(HostDB *db) {
+  IP **by_id, **tmp, **t;
+  int count[257];
+  int i, n, byte;
+
+  n = (db->nkeys > 0) ? db->ip_start[db->nkeys] : 0;
+  by_id = calloc(db->nips+1, sizeof(IP *));
+  for (i = 0; i < n; i++) by_id[db->ips[i]->id] = db->ips[i];
+
+  db->by_addr = malloc(sizeof(IP *)*(db->nips+1));
+  db->naddrs = 0;
+  for (i = 0; i < db->nips; i++) {
+    if (by_id[i] != NULL) db->by_addr[db->naddrs++] = by_id[i];
+  }
+
+  tmp = by_id;
+  for (byte = 3; byte >= 0; byte--) {
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < db->naddrs; i++) count[db->by_addr[i]->address[byte]+1]++;
+    for (i = 0; i < 256; i++) count[i+1] += count[i];
+    for (i = 0; i < db->naddrs; i++) tmp[count[db->by_addr[i]->address[byte]]++] = db->by_addr[i];
+    t = db->by_addr;
+    db->by_addr = tmp;
+    tmp = t;
+  }
+  free(tmp);
+
+  db->anodes = malloc(sizeof(AddrNode)*(2*db->naddrs+1));
+  db->nanodes = 0;
+  if (db->naddrs > 0) BuildNode(db, 0, db->naddrs);
+}
+
+/* @name: HostDBFindAddr
+   @brief: Looks up every IP in an address block.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] addr: The block's address, first byte highest.
+   @param[in] plen: The block's prefix length: 32 finds one address, 0 finds all.
+   @param[out] n: Set to the number of IPs.
+   @return: Returns the IPs, by address, or NULL if there are none. */
+
+IP **HostDBFindAddr(HostDB *db, unsigned int addr, int plen, int *n) {
+  AddrNode *node;
+  int k;
+
+  *n = 0;
+  if (db->nanodes == 0) return NULL;
+  k = 0;
+  while (1) {
+    node = &db->anodes[k];
+    if ((node->prefix ^ addr) & PrefixMask((node->bits < plen) ? node->bits : plen)) return NULL;
+    if (node->bits >= plen) break;
+    k = node->child[(addr >> (31 - node->bits)) & 1];
+  }
+  *n = node->hi - node->lo;
+  return db->by_addr + node->lo;
+}
+
+/* @name: ParseAddr
+   @brief: Reads a query as an address ("a.b.c.d") or a CIDR block
+           ("a.b.c.d/n"). Anything else is a host name.
+   @param[in] s: The query.
+   @param[out] addr: Set to the address, first byte highest.
+   @param[out] plen: Set to the prefix length (32 for a bare address).
+   @return: Returns 0, or -1 if s is not an address. */
+
+int ParseAddr(const char *s, unsigned int *addr, int *plen) {
+  unsigned int b[4];
+  int len, used;
+
+  used = -1;
+  len = 32;
+  if (sscanf(s, "%3u.%3u.%3u.%3u%n/%2d%n", &b[0], &b[1], &b[2], &b[3], &used, &len, &used) < 4) return -1;
+  if (used < 0 || s[used] != '\0') return -1;
+  if (b[0] > 255 || b[1] > 255 || b[2] > 255 || b[3] > 255 || len < 0 || len > 32) return -1;
+
+  *addr = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  *plen = len;
+  return 0;
+}
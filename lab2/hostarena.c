@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hostdb.h"
+
+/* hostarena.c
+   Riley Crockett
+
+   The memory behind a host index. IPs, their name lists, and any names
+   that had to be copied out of a read buffer are carved out of big blocks
+   one after another, instead of each getting its own malloc. Nothing in an
+   arena is freed on its own: the whole arena goes at once when its index is
+   freed (see HostDBFree), as hostserve does with the old index on a reload.
+
+   Copied names are also interned: a name that is read again (the same host
+   in many records, say) is stored once, and every IP with it points at the
+   same bytes. A short name is a span of its full name, so it never takes
+   any room of its own.
+   */
+
+#define ARENA_BLOCK (1 << 20)
+
+/* @name: ArenaAlloc
+   @brief: Carves 8-byte-aligned memory out of an arena. A request too big
+           to share a block gets a block of its own, and the current block
+           keeps the rest of its room.
+   @param[in] a: The arena.
+   @param[in] size: The number of bytes.
+   @return: Returns the memory, which is zeroed. */
+
+void *ArenaAlloc(Arena *a, size_t size) {
+  ArenaBlock *b;
+  size_t bsize;
+
+  size = (size + 7) & ~(size_t) 7;
+  b = a->block;
+  if (b == NULL || b->size - b->used < size) {
+    bsize = (size > ARENA_BLOCK / 4) ? size : ARENA_BLOCK;
+    b = calloc(1, sizeof(ArenaBlock) + bsize);
+    b->size = bsize;
+    if (bsize == size && a->block != NULL) {
+      b->next = a->block->next;
+      a->block->next = b;
+    } else {
+      b->next = a->block;
+      a->block = b;
+    }
+    a->total += bsize;
+  }
+  b->used += size;
+  return (char *) (b + 1) + b->used - size;
+}
+
+/* @name: ArenaAdopt
+   @brief: Moves every block of one arena into another, leaving it empty.
+           The memory stays where it is, so pointers into it stay good.
+   @param[in] a: The arena that takes the blocks.
+   @param[in] from: The arena that gives them up. */
+
+void ArenaAdopt(Arena *a, Arena *from) {
+  ArenaBlock *b;
+
+  if (from->block == NULL) return;
+  if (a->block == NULL) {
+    *a = *from;
+  } else {
+
+    /* Keep a's current block first, so it goes on filling. */
+
+    for (b = from->block; b->next != NULL; b = b->next) ;
+    b->next = a->block->next;
+    a->block->next = from->block;
+    a->total += from->total;
+  }
+  from->block = NULL;
+  from->total = 0;
+}
+
+/* @name: InternName
+   @brief: Finds a name among the index's copied names, copying it into the
+           arena (with a NUL after it) the first time it is seen.
+   @param[in] db: The index.
+   @param[in] s: The name.
+   @param[in] len: The length of the name.
+   @return: Returns the stored copy. */
+
+const char *InternName(HostDB *db, const char *s, int len) {
+  HostSlot *slots, *sl;
+  unsigned int h, i, j, nslots;
+  char *copy;
+
+  /* Keep the table at most half full. */
+
+  if (2 * (unsigned int) (db->ninterned + 1) > db->nislots) {
+    nslots = (db->nislots == 0) ? 1024 : db->nislots * 2;
+    slots = malloc(sizeof(HostSlot)*nslots);
+    for (i = 0; i < nslots; i++) slots[i].key = -1;
+    for (j = 0; j < db->nislots; j++) {
+      if (db->islots[j].key == -1) continue;
+      for (i = db->islots[j].hash & (nslots - 1); slots[i].key != -1; i = (i + 1) & (nslots - 1)) ;
+      slots[i] = db->islots[j];
+    }
+    free(db->islots);
+    db->islots = slots;
+    db->nislots = nslots;
+    db->interned = realloc(db->interned, sizeof(HostName)*(nslots / 2));
+  }
+
+  h = HashName(s, len);
+  for (i = h & (db->nislots - 1); ; i = (i + 1) & (db->nislots - 1)) {
+    sl = &db->islots[i];
+    if (sl->key == -1) break;
+    if (sl->hash == h && db->interned[sl->key].len == len && !memcmp(db->interned[sl->key].s, s, len)) {
+      return db->interned[sl->key].s;
+    }
+  }
+
+  copy = ArenaAlloc(&db->arena, len + 1);
+  memcpy(copy, s, len);
+  sl->hash = h;
+  sl->key = db->ninterned;
+  db->interned[db->ninterned].s = copy;
+  db->interned[db->ninterned].len = len;
+  db->ninterned++;
+  return copy;
+}
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "hostdb.h"
+
+/* hostbench.c
+   Riley Crockett
+
+   This program times every way of loading a 'converted' file (see hostio.c),
+   each with the file cold (dropped from the page cache first) and warm (just
+   read). Each run is its own child process, so that its peak RSS and I/O
+   counters are its own. For each run it prints:
+     load     ms to load the file, and build the index from it
+     syscalls the reads counted by /proc/self/io, plus the loader's seeks and
+              other calls (see HostIO in hostdb.h)
+     disk     MB the kernel read from the device (0 when warm)
+     copied   MB the reads copied out of the page cache (none for mmap)
+     rss      peak resident MB
+     lookups  name lookups per second on the built index
+
+   Cold runs flush the file and use posix_fadvise to drop its pages, which
+   does not need root. If "disk" is still 0 on a cold run, something else
+   kept the file cached and the run was really warm.
+
+   Usage: hostbench [-q lookups] [-j threads] converted
+   */
+
+/* This struct defines one way of loading the file. */
+
+typedef struct strategy {
+  char *name;
+  int (*load)(HostDB *db, char *file, int nthreads);
+} Strategy;
+
+/* This struct defines the counters from /proc/self/io that matter here. */
+
+typedef struct procio {
+  long rchar;
+  long syscr;
+  long read_bytes;
+} ProcIO;
+
+/* @name: BenchFread, BenchSyscalls, BenchOneRead
+   @brief: Fit the single-threaded loaders to Strategy.
+   @param[in] db: The index.
+   @param[in] file: The file.
+   @param[in] nthreads: Unused.
+   @return: Returns what the loader does. */
+
+int BenchFread(HostDB *db, char *file, int nthreads) {
+  (void) nthreads;
+  return LoadFread(db, file);
+}
+
+int BenchSyscalls(HostDB *db, char *file, int nthreads) {
+  (void) nthreads;
+  return LoadSyscalls(db, file);
+}
+
+int BenchOneRead(HostDB *db, char *file, int nthreads) {
+  (void) nthreads;
+  return LoadOneRead(db, file);
+}
+
+Strategy Strategies[] = {
+  { "fread", BenchFread },
+  { "read", BenchSyscalls },
+  { "oneread", BenchOneRead },
+  { "mmap", MapConverted },
+  { "uring", LoadUring },
+};
+
+#define NSTRATEGIES (int) (sizeof(Strategies) / sizeof(Strategies[0]))
+
+/* @name: Now
+   @brief: Reads the monotonic clock.
+   @return: Returns the time in seconds. */
+
+double Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* @name: ReadProcIO
+   @brief: Reads this process's I/O counters.
+   @param[out] io: The counters, or all 0 if /proc/self/io can't be read. */
+
+void ReadProcIO(ProcIO *io) {
+  FILE *f;
+  char key[64];
+  long v;
+
+  memset(io, 0, sizeof(ProcIO));
+  f = fopen("/proc/self/io", "r");
+  if (f == NULL) return;
+  while (fscanf(f, "%63s %ld", key, &v) == 2) {
+    if (strcmp(key, "rchar:") == 0) io->rchar = v;
+    else if (strcmp(key, "syscr:") == 0) io->syscr = v;
+    else if (strcmp(key, "read_bytes:") == 0) io->read_bytes = v;
+  }
+  fclose(f);
+}
+
+/* @name: Prepare
+   @brief: Makes a file cold, by dropping its pages from the page cache, or
+           warm, by reading it all.
+   @param[in] file: The file.
+   @param[in] cold: 1 for cold, 0 for warm.
+   @return: Returns 0, or -1 if the file can't be opened. */
+
+int Prepare(char *file, int cold) {
+  char buf[65536];
+  int f;
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    perror(file);
+    return -1;
+  }
+  if (cold) {
+    fdatasync(f);
+    posix_fadvise(f, 0, 0, POSIX_FADV_DONTNEED);
+  } else {
+    while (read(f, buf, sizeof(buf)) > 0) ;
+  }
+  close(f);
+  return 0;
+}
+
+/* @name: RunOne
+   @brief: The child's side of one run: loads and builds the index, times
+           lookups on it, and prints the run's row (less its RSS, which the
+           parent adds).
+   @param[in] s: The strategy.
+   @param[in] file: The file.
+   @param[in] nthreads: The loader threads, for the loaders that use them.
+   @param[in] nlookups: The number of lookups to time.
+   @return: Returns 0, or -1 if the load failed. */
+
+int RunOne(Strategy *s, char *file, int nthreads, int nlookups) {
+  HostDB *db;
+  ProcIO base, before, after;
+  HostName *pick;
+  double start, load, secs;
+  int i, n;
+
+  /* Reading /proc/self/io is itself a read or two; take that back out. */
+
+  ReadProcIO(&base);
+  ReadProcIO(&before);
+  memset(&HostIO, 0, sizeof(HostIO));
+  start = Now();
+  db = NewHostDB();
+  if (s->load(db, file, nthreads) == -1) return -1;
+  HostDBBuild(db);
+  load = Now() - start;
+  ReadProcIO(&after);
+
+  /* Look up names that exist, picked up front so picking isn't timed. */
+
+  secs = 0;
+  if (db->nkeys > 0) {
+    pick = malloc(sizeof(HostName)*nlookups);
+    srandom(1);
+    for (i = 0; i < nlookups; i++) pick[i] = db->keys[random() % db->nkeys];
+    start = Now();
+    for (i = 0; i < nlookups; i++) HostDBFind(db, pick[i].s, pick[i].len, &n);
+    secs = Now() - start;
+    free(pick);
+  }
+
+  printf("%9.1f %9ld %9.1f %10.1f ", load * 1e3,
+         after.syscr - 2*before.syscr + base.syscr + HostIO.seeks + HostIO.calls,
+         (after.read_bytes - before.read_bytes) / 1e6,
+         (after.rchar - 2*before.rchar + base.rchar + HostIO.bytes) / 1e6);
+  printf("%12.0f ", (secs > 0) ? nlookups / secs : 0);
+  fflush(stdout);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  struct rusage ru;
+  char *file;
+  int nlookups, nthreads, c, i, cold, status;
+  pid_t pid;
+
+  nlookups = 1000000;
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  while ((c = getopt(argc, argv, "q:j:")) != -1) {
+    if (c == 'q') {
+      nlookups = atoi(optarg);
+    } else if (c == 'j') {
+      nthreads = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: hostbench [-q lookups] [-j threads] converted\n");
+      exit(1);
+    }
+  }
+  if (argc - optind != 1 || nlookups < 1 || nthreads < 1) {
+    fprintf(stderr, "usage: hostbench [-q lookups] [-j threads] converted\n");
+    exit(1);
+  }
+  file = argv[optind];
+
+  printf("%-8s %-4s %9s %9s %9s %10s %12s %8s\n",
+         "strategy", "mode", "load(ms)", "syscalls", "disk(MB)", "copied(MB)", "lookups/s", "rss(MB)");
+  for (i = 0; i < NSTRATEGIES; i++) {
+    for (cold = 1; cold >= 0; cold--) {
+      if (Prepare(file, cold) == -1) exit(1);
+      printf("%-8s %-4s ", Strategies[i].name, cold ? "cold" : "warm");
+      fflush(stdout);
+
+      pid = fork();
+      if (pid == 0) exit(RunOne(Strategies + i, file, nthreads, nlookups) == -1);
+      if (wait4(pid, &status, 0, &ru) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("failed\n");
+        continue;
+      }
+      printf("%8.1f\n", ru.ru_maxrss / 1024.0);
+    }
+  }
+  return 0;
+}
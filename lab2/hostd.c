@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "sockettome.h"
+#include "hostserve.h"
+
+/* hostd.c
+   Riley Crockett
+
+   This program serves host lookups over TCP, so a client can ask many
+   questions of one loaded index instead of starting an l2p program (and
+   reading all of 'converted') for each. The index follows 'converted' as it
+   changes (see hostserve.h).
+
+   The protocol is one query per line, in the same forms as the lookup
+   prompt: a host name, an address or CIDR block, or a pattern with a '*'.
+   Each answer is "OK n" followed by n lines of IPs (n is 0 if nothing
+   matched). A client may send any number of queries without waiting, and
+   the answers come back in the order the queries were sent.
+
+   A fixed pool of worker threads waits on one epoll set of every
+   connection. Each connection is registered one-shot, so once a worker
+   picks it up, no other worker sees it until the worker has finished its
+   turn with it and re-armed it. That is what keeps each connection's
+   answers in order. A turn is bounded (see ServeConn): a
+   client that sends faster than it reads is made to wait on its own
+   socket, not a worker.
+
+   Usage: hostd port [-t workers] [-f converted]
+   */
+
+/* The most bytes a query may have before its connection is dropped. */
+#define MAX_QUERY 4096
+
+/* The most bytes read from one connection before answering them, so a
+   client that never stops sending still gets answers (and other clients
+   still get a turn). */
+#define READ_BATCH 65536
+
+/* Answering stops for a turn once this many bytes of answers are waiting
+   to be sent, so a client that pipelines faster than it reads can't make
+   the server buffer without bound. */
+#define OUT_LIMIT (256 * 1024)
+
+/* The most queries answered under one HostReadLock, so a long batch doesn't
+   hold up a reload. */
+#define LOCK_SLICE 64
+
+/* This struct defines a connection: the bytes read but not yet answered,
+   and the answers not yet sent (out_off of them have been). */
+
+typedef struct conn {
+  int fd;
+  char *in;
+  int in_len;
+  int in_cap;
+  char *out;
+  int out_len;
+  int out_off;
+  int out_cap;
+  int eof;            /* The client has finished sending. */
+} Conn;
+
+/* This struct defines what every worker shares. */
+
+typedef struct pool {
+  HostServer *srv;
+  int epfd;
+} Pool;
+
+/* @name: Append
+   @brief: Appends bytes to a connection's answers.
+   @param[in] c: The connection.
+   @param[in] s: The bytes.
+   @param[in] len: The number of bytes. */
+
+void Append(Conn *c, const char *s, int len) {
+  if (c->out_len + len > c->out_cap) {
+    while (c->out_len + len > c->out_cap) c->out_cap = (c->out_cap == 0) ? 4096 : c->out_cap * 2;
+    c->out = realloc(c->out, c->out_cap);
+  }
+  memcpy(c->out + c->out_len, s, len);
+  c->out_len += len;
+}
+
+/* @name: Answer
+   @brief: Answers one query into a connection's answers.
+   @param[in] c: The connection.
+   @param[in] db: The index.
+   @param[in] q: The query. */
+
+void Answer(Conn *c, HostDB *db, char *q) {
+  char line[64];
+  IP **ips;
+  IP *ip;
+  int i, j, n, owned, len;
+
+  ips = RunQuery(db, q, &n, &owned);
+  len = sprintf(line, "OK %d\n", n);
+  Append(c, line, len);
+  for (i = 0; i < n; i++) {
+    ip = ips[i];
+    len = sprintf(line, "%d.%d.%d.%d:", ip->address[0], ip->address[1], ip->address[2], ip->address[3]);
+    Append(c, line, len);
+    for (j = 0; j < ip->nnames; j++) {
+      Append(c, " ", 1);
+      Append(c, ip->names[j].s, ip->names[j].len);
+    }
+    Append(c, "\n", 1);
+  }
+  if (owned) free(ips);
+}
+
+/* @name: Flush
+   @brief: Sends as much of a connection's answers as the socket will take
+           without blocking.
+   @param[in] c: The connection.
+   @return: Returns 1 if everything was sent, 0 if some is left, or -1 if
+            the connection failed. */
+
+int Flush(Conn *c) {
+  ssize_t n;
+
+  while (c->out_off < c->out_len) {
+    n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+    if (n > 0) {
+      c->out_off += n;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else {
+      return -1;
+    }
+  }
+  c->out_len = c->out_off = 0;
+  return 1;
+}
+
+/* @name: ServeConn
+   @brief: Gives a connection one turn: sends what is left of its answers,
+           then reads what it has sent so far and answers whole queries,
+           until OUT_LIMIT bytes of answers are waiting, and sends them.
+           Nothing more is read from a connection until its answers are
+           all sent.
+   @param[in] c: The connection.
+   @param[in] srv: The index.
+   @param[in] reader: The worker's reader slot.
+   @return: Returns EPOLLIN to wait for more queries, EPOLLOUT to wait until
+            it can send again (or to come back for queries already read), or
+            -1 if it is done. */
+
+int ServeConn(Conn *c, HostServer *srv, int reader) {
+  HostDB *db;
+  char *line, *nl, *end;
+  ssize_t n;
+  int off, k, r;
+
+  r = Flush(c);
+  if (r != 1) return (r == 0) ? EPOLLOUT : -1;
+
+  while (!c->eof && c->in_len < READ_BATCH) {
+    if (c->in_cap - c->in_len < 4096) {
+      c->in_cap = (c->in_cap == 0) ? 8192 : c->in_cap * 2;
+      c->in = realloc(c->in, c->in_cap);
+    }
+    n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, MSG_DONTWAIT);
+    if (n > 0) {
+      c->in_len += n;
+    } else if (n == 0) {
+      c->eof = 1;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  }
+
+  /* Answer each whole line, a slice at a time; a partial one waits for the
+     rest. */
+
+  line = c->in;
+  end = c->in + c->in_len;
+  nl = memchr(line, '\n', end - line);
+  while (nl != NULL && c->out_len < OUT_LIMIT) {
+    db = HostReadLock(srv, reader);
+    for (k = 0; k < LOCK_SLICE && nl != NULL && c->out_len < OUT_LIMIT; k++) {
+      *nl = '\0';
+      if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+      if (*line != '\0') Answer(c, db, line);
+      line = nl + 1;
+      nl = memchr(line, '\n', end - line);
+    }
+    HostReadUnlock(srv, reader);
+  }
+
+  off = line - c->in;
+  memmove(c->in, line, c->in_len - off);
+  c->in_len -= off;
+  if (nl == NULL && c->in_len > MAX_QUERY) return -1;
+
+  r = Flush(c);
+  if (r == -1) return -1;
+  if (r == 0 || nl != NULL) return EPOLLOUT;
+  return c->eof ? -1 : EPOLLIN;
+}
+
+/* @name: Worker
+   @brief: The start routine of pthread_create for the workers. Each takes
+           one ready connection at a time, serves it, and re-arms it.
+   @param[in] arg: The pool. */
+
+void *Worker(void *arg) {
+  Pool *pool = (Pool *) arg;
+  struct epoll_event ev;
+  Conn *c;
+  int reader, want;
+
+  reader = HostReaderRegister(pool->srv);
+  if (reader == -1) {
+    fprintf(stderr, "hostd: too many workers (at most %d)\n", MAX_READERS);
+    exit(1);
+  }
+
+  while (1) {
+    if (epoll_wait(pool->epfd, &ev, 1, -1) != 1) continue;
+    c = (Conn *) ev.data.ptr;
+    want = ServeConn(c, pool->srv, reader);
+    if (want == -1) {
+      close(c->fd);
+      free(c->in);
+      free(c->out);
+      free(c);
+      continue;
+    }
+    ev.events = want | EPOLLONESHOT;
+    ev.data.ptr = c;
+    epoll_ctl(pool->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Pool pool;
+  pthread_t tid;
+  struct epoll_event ev;
+  Conn *c;
+  char *file;
+  int port, nworkers, sock, fd, i, one;
+
+  if (argc < 2 || (port = atoi(argv[1])) <= 0) {
+    fprintf(stderr, "usage: hostd port [-t workers] [-f converted]\n");
+    return -1;
+  }
+  nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+  file = "converted";
+  for (i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      nworkers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-f") == 0 && i+1 < argc) {
+      file = argv[++i];
+    } else {
+      fprintf(stderr, "usage: hostd port [-t workers] [-f converted]\n");
+      return -1;
+    }
+  }
+  if (nworkers < 1) nworkers = 1;
+
+  /* A client that hangs up mid-answer should only end its own connection. */
+
+  signal(SIGPIPE, SIG_IGN);
+
+  pool.srv = StartHostServer(file, sysconf(_SC_NPROCESSORS_ONLN));
+  if (pool.srv == NULL) return -1;
+  pool.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (pool.epfd == -1) {
+    perror("epoll_create1");
+    return -1;
+  }
+  for (i = 0; i < nworkers; i++) {
+    pthread_create(&tid, NULL, Worker, &pool);
+    pthread_detach(tid);
+  }
+
+  /* sockettome's accept_connection listens with a backlog of 1 before
+     each accept, which resets clients that connect together; listen once
+     with a full backlog instead. */
+
+  sock = serve_socket(port);
+  if (listen(sock, SOMAXCONN) == -1) {
+    perror("listen");
+    return -1;
+  }
+  printf("Serving %s on port %d with %d workers\n", file, port, nworkers);
+  fflush(stdout);
+  while (1) {
+    fd = accept(sock, NULL, NULL);
+    if (fd == -1) {
+      if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+      continue;
+    }
+
+    /* Answers are written as soon as they're ready; waiting to fill a
+       segment would only add to a pipelined client's latency. A worker
+       must never block on one client, so the socket is non-blocking. */
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c = calloc(1, sizeof(Conn));
+    c->fd = fd;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(pool.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      perror("epoll_ctl");
+      close(fd);
+      free(c);
+    }
+  }
+}
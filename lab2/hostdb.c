@@ -0,0 +1,684 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "hostdb.h"
+
+/* hostdb.c
+   Riley Crockett
+
+   This stores the hosts read from the 'converted' file, and answers host name
+   lookups with a single hash probe (see hostdb.h).
+   */
+
+IOStats HostIO;
+
+/* The most names split off by one call to ScanNames. */
+#define NAME_CHUNK 64
+
+/* This struct defines one thread's range of a mapped 'converted' file, and
+   the partial index it builds from it. */
+
+typedef struct loadrange {
+  const unsigned char *start;
+  const unsigned char *end;
+  int first_id;      /* The number of records before start. */
+  HostDB *part;
+} LoadRange;
+
+/* @name: HashName
+   @brief: Hashes a name with 32-bit FNV-1a.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @return: Returns the hash. */
+
+unsigned int HashName(const char *name, int len) {
+  unsigned int h = 2166136261u;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* @name: NewHostDB
+   @brief: Allocates an empty host index.
+   @return: Returns the index. */
+
+HostDB *NewHostDB() {
+  return calloc(1, sizeof(HostDB));
+}
+
+/* @name: NewIP
+   @brief: Allocates an IP with no names in the index's arena. Its names are
+           added with AddName, and it is finished by HostDBAdd.
+   @param[in] db: The index.
+   @return: Returns the IP. */
+
+IP *NewIP(HostDB *db) {
+  db->npending = 0;
+  return ArenaAlloc(&db->arena, sizeof(IP));
+}
+
+/* @name: AddName
+   @brief: Appends a name to the IP being loaded.
+   @param[in] db: The index.
+   @param[in] s: The name. It must outlive the index.
+   @param[in] len: The length of the name. */
+
+void AddName(HostDB *db, const char *s, int len) {
+  if (db->npending == db->pending_cap) {
+    db->pending_cap = (db->pending_cap == 0) ? 16 : db->pending_cap * 2;
+    db->pending = realloc(db->pending, sizeof(HostName)*db->pending_cap);
+  }
+  db->pending[db->npending].s = s;
+  db->pending[db->npending].len = len;
+  db->npending++;
+}
+
+/* @name: AddNames
+   @brief: Appends a full host name to the IP being loaded, after its short
+           name if it has one.
+   @param[in] db: The index.
+   @param[in] s: The full name. It must outlive the index.
+   @param[in] len: The length of the name.
+   @param[in] dot: The offset of the first '.' in the name, or -1 (see ScanNames). */
+
+void AddNames(HostDB *db, const char *s, int len, int dot) {
+  if (dot >= 0) AddName(db, s, dot);
+  AddName(db, s, len);
+}
+
+/* @name: ReadNames
+   @brief: Adds host names in a buffer to the IP being loaded. The buffer
+           may be reused, so each name is interned (see InternName).
+   @param[in] db: The index.
+   @param[in] buf: The host name buffer.
+   @param[in] nnames: The number of names.
+   @param[in] prev_i: The start of the name.
+   @param[in] i: The current index.
+   @param[in] end: The end of the buffer.
+   @param[out] : Returns the current index in the buffer. */
+
+int ReadNames(HostDB *db, char *buf, int nnames, int prev_i, int i, int end)
+{
+  NameTok toks[NAME_CHUNK];
+  const char *next;
+  int n, k;
+
+  if (nnames <= 0) return i;
+  next = buf + prev_i;
+  while (nnames > 0) {
+    n = ScanNames(next, buf + end, (nnames < NAME_CHUNK) ? nnames : NAME_CHUNK, toks, &next);
+    for (k = 0; k < n; k++) AddNames(db, InternName(db, toks[k].s, toks[k].len), toks[k].len, toks[k].dot);
+    nnames -= n;
+    if (n < NAME_CHUNK && nnames > 0) return end;
+  }
+  return next - buf;
+}
+
+/* @name: ParseRecords
+   @brief: Adds every IP in part of a mapped 'converted' file to the index.
+           Each record is a 4-byte address, a 4-byte big-endian name count,
+           and that many NUL-terminated names. The names are spans into the
+           mapping. A truncated record ends the read.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] p: The first record.
+   @param[in] end: The end of the records. */
+
+void ParseRecords(HostDB *db, const unsigned char *p, const unsigned char *end) {
+  NameTok toks[NAME_CHUNK];
+  const char *next;
+  unsigned int nnames;
+  int n, k;
+  IP *ip;
+
+  while (end - p >= 8) {
+    ip = NewIP(db);
+    memcpy(ip->address, p, 4);
+    nnames = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    p += 8;
+
+    /* Split the names off in chunks, so a record with many names still
+       needs only one small array. */
+    next = (const char *) p;
+    while (nnames > 0) {
+      n = ScanNames(next, (const char *) end, (nnames < NAME_CHUNK) ? nnames : NAME_CHUNK, toks, &next);
+      for (k = 0; k < n; k++) AddNames(db, toks[k].s, toks[k].len, toks[k].dot);
+      nnames -= n;
+      if (n < NAME_CHUNK && nnames > 0) break;
+    }
+    if (nnames > 0) break;
+    p = (const unsigned char *) next;
+
+    /* Make an entry in the index for each name. */
+    HostDBAdd(db, ip);
+  }
+}
+
+/* @name: SkipRecord
+   @brief: Finds the end of one record without storing anything.
+   @param[in] p: The record.
+   @param[in] end: The end of the file.
+   @return: Returns the next record, or NULL if this one is truncated. */
+
+const unsigned char *SkipRecord(const unsigned char *p, const unsigned char *end) {
+  unsigned int nnames, k;
+
+  if (end - p < 8) return NULL;
+  nnames = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+  p += 8;
+  for (k = 0; k < nnames; k++) {
+    p = memchr(p, '\0', end - p);
+    if (p == NULL) return NULL;
+    p++;
+  }
+  return p;
+}
+
+/* @name: LoadRangeThread
+   @brief: The start routine of pthread_create for the loaders. This parses
+           one range of the file and builds a partial index from it.
+   @param[in] arg: The range. */
+
+void *LoadRangeThread(void *arg) {
+  LoadRange *r = (LoadRange *) arg;
+
+  r->part = NewHostDB();
+  r->part->nips = r->first_id;
+  ParseRecords(r->part, r->start, r->end);
+  BuildKeys(r->part);
+  return NULL;
+}
+
+/* @name: ParseConverted
+   @brief: Adds every IP in a 'converted' file's bytes to the index (see
+           ParseRecords). The bytes must outlive the index.
+
+           With more than one thread, a prescan hops from record to record
+           (only looking for NULs) to find the record boundaries nearest to
+           nthreads equal splits of the file. Each thread then parses and
+           builds a partial index of its range, and HostDBBuild merges them.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] map: The file's bytes.
+   @param[in] size: The number of bytes.
+   @param[in] nthreads: The number of loader threads. 1 or less loads on this one. */
+
+void ParseConverted(HostDB *db, const unsigned char *map, size_t size, int nthreads) {
+  int k, nrecords;
+  const unsigned char *p, *q, *end;
+  LoadRange *ranges;
+  pthread_t *tids;
+
+  end = map + size;
+  if (nthreads <= 1) {
+    ParseRecords(db, map, end);
+    return;
+  }
+
+  /* Prescan for boundaries. If a truncated record turns up, every range from
+     there on is empty, so nobody reads past it. */
+
+  ranges = calloc(nthreads, sizeof(LoadRange));
+  ranges[0].start = map;
+  p = map;
+  nrecords = 0;
+  for (k = 1; k < nthreads; k++) {
+    while (p - map < (long long) size * k / nthreads) {
+      q = SkipRecord(p, end);
+      if (q == NULL) {
+        end = p;
+        break;
+      }
+      p = q;
+      nrecords++;
+    }
+    ranges[k].start = p;
+    ranges[k].first_id = nrecords;
+    ranges[k-1].end = p;
+  }
+  ranges[nthreads-1].end = end;
+
+  tids = malloc(sizeof(pthread_t)*nthreads);
+  for (k = 0; k < nthreads; k++) pthread_create(&tids[k], NULL, LoadRangeThread, ranges+k);
+  for (k = 0; k < nthreads; k++) pthread_join(tids[k], NULL);
+
+  db->parts = malloc(sizeof(HostDB *)*nthreads);
+  db->nparts = nthreads;
+  for (k = 0; k < nthreads; k++) db->parts[k] = ranges[k].part;
+  free(tids);
+  free(ranges);
+}
+
+/* @name: MapConverted
+   @brief: Maps a whole 'converted' file and adds every IP in it to the index
+           (see ParseConverted). The mapping lasts until HostDBFree.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @param[in] nthreads: The number of loader threads. 1 or less loads on this one.
+   @return: Returns 0, or -1 if the file could not be mapped. */
+
+int MapConverted(HostDB *db, char *file, int nthreads) {
+  int f;
+  struct stat st;
+  unsigned char *map;
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+  if (fstat(f, &st) == -1) {
+    perror(file);
+    close(f);
+    return -1;
+  }
+
+  /* MAP_POPULATE faults the whole file in up front, and it is read front to back. */
+
+  map = NULL;
+  if (st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, f, 0);
+    if (map == MAP_FAILED) {
+      perror("mmap");
+      close(f);
+      return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    HostIO.calls += 2;
+  }
+  close(f);
+
+  db->data = map;
+  db->data_size = st.st_size;
+  db->data_mapped = 1;
+  ParseConverted(db, map, st.st_size, nthreads);
+  return 0;
+}
+
+/* @name: ReadConverted
+   @brief: Reads a whole 'converted' file into memory and adds every IP in it
+           to the index (see ParseConverted). Unlike a mapping, the copy
+           cannot change if the file is rewritten while the index is in use.
+           It lasts until HostDBFree.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @param[in] nthreads: The number of loader threads. 1 or less loads on this one.
+   @return: Returns 0, or -1 if the file could not be read. */
+
+int ReadConverted(HostDB *db, char *file, int nthreads) {
+  int f;
+  struct stat st;
+  unsigned char *buf;
+  size_t size;
+  ssize_t n;
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+  if (fstat(f, &st) == -1) {
+    perror(file);
+    close(f);
+    return -1;
+  }
+
+  /* The file may grow or shrink while it is read, so stop at whichever
+     comes first: its end, or the size it had. */
+
+  buf = malloc(st.st_size + 1);
+  size = 0;
+  while (size < (size_t) st.st_size) {
+    n = read(f, buf + size, st.st_size - size);
+    if (n == -1) {
+      perror(file);
+      free(buf);
+      close(f);
+      return -1;
+    }
+    if (n == 0) break;
+    size += n;
+  }
+  close(f);
+
+  db->data = buf;
+  db->data_size = size;
+  db->data_mapped = 0;
+  ParseConverted(db, buf, size, nthreads);
+  return 0;
+}
+
+/* @name: HostDBAdd
+   @brief: Finishes the IP being loaded, moving its names into the arena, and
+           adds it to the index under each of them.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] ip: The IP, from NewIP. */
+
+void HostDBAdd(HostDB *db, IP *ip) {
+  int i;
+
+  ip->id = db->nips++;
+  ip->nnames = db->npending;
+  if (ip->nnames > 0) {
+    ip->names = ArenaAlloc(&db->arena, sizeof(HostName)*ip->nnames);
+    memcpy(ip->names, db->pending, sizeof(HostName)*ip->nnames);
+  }
+  db->npending = 0;
+  for (i = 0; i < ip->nnames; i++) {
+    if (db->npairs == db->pairs_cap) {
+      db->pairs_cap = (db->pairs_cap == 0) ? 1024 : db->pairs_cap * 2;
+      db->pair_name = realloc(db->pair_name, sizeof(HostName)*db->pairs_cap);
+      db->pair_ip = realloc(db->pair_ip, sizeof(IP *)*db->pairs_cap);
+    }
+    db->pair_name[db->npairs] = ip->names[i];
+    db->pair_ip[db->npairs] = ip;
+    db->npairs++;
+  }
+}
+
+/* @name: FindSlot
+   @brief: Probes the name table for a name (linear probing).
+   @param[in] db: The index.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @param[in] h: The name's hash.
+   @return: Returns the slot holding the name, or the empty slot where it would go. */
+
+HostSlot *FindSlot(HostDB *db, const char *name, int len, unsigned int h) {
+  unsigned int i;
+  HostSlot *s;
+
+  for (i = h & (db->nslots - 1); ; i = (i + 1) & (db->nslots - 1)) {
+    s = &db->slots[i];
+    if (s->key == -1) return s;
+    if (s->hash == h && db->keys[s->key].len == len && !memcmp(db->keys[s->key].s, name, len)) return s;
+  }
+}
+
+/* @name: MergeParts
+   @brief: Builds the index from the partial indexes in db->parts. Each part's
+           keys go into one table, and each key's IPs are gathered from the
+           parts in file order, so they stay in the order they were read.
+   @param[in] db: The index. */
+
+void MergeParts(HostDB *db) {
+  HostDB *part;
+  HostSlot *s, *ps;
+  int **gkey;
+  int *next;
+  int k, g, i, n, total;
+  unsigned int j;
+
+  total = 0;
+  n = 0;
+  for (k = 0; k < db->nparts; k++) {
+    total += db->parts[k]->nkeys;
+    n += db->parts[k]->ip_start[db->parts[k]->nkeys];
+  }
+
+  db->nslots = 16;
+  while (db->nslots < 2 * (unsigned int) total) db->nslots *= 2;
+  db->slots = malloc(sizeof(HostSlot)*db->nslots);
+  for (j = 0; j < db->nslots; j++) db->slots[j].key = -1;
+  db->keys = malloc(sizeof(HostName)*(total+1));
+  db->nkeys = 0;
+
+  /* Map every part's keys to global keys, reusing the hashes in its slots. */
+
+  gkey = malloc(sizeof(int *)*db->nparts);
+  for (k = 0; k < db->nparts; k++) {
+    part = db->parts[k];
+    gkey[k] = malloc(sizeof(int)*(part->nkeys+1));
+    for (j = 0; j < part->nslots; j++) {
+      ps = &part->slots[j];
+      if (ps->key == -1) continue;
+      s = FindSlot(db, part->keys[ps->key].s, part->keys[ps->key].len, ps->hash);
+      if (s->key == -1) {
+        s->hash = ps->hash;
+        s->key = db->nkeys;
+        db->keys[db->nkeys++] = part->keys[ps->key];
+      }
+      gkey[k][ps->key] = s->key;
+    }
+  }
+
+  db->ip_start = calloc(db->nkeys+1, sizeof(int));
+  for (k = 0; k < db->nparts; k++) {
+    part = db->parts[k];
+    for (i = 0; i < part->nkeys; i++) db->ip_start[gkey[k][i]+1] += part->ip_start[i+1] - part->ip_start[i];
+  }
+  for (g = 0; g < db->nkeys; g++) db->ip_start[g+1] += db->ip_start[g];
+
+  next = malloc(sizeof(int)*(db->nkeys+1));
+  memcpy(next, db->ip_start, sizeof(int)*db->nkeys);
+  db->ips = malloc(sizeof(IP *)*(n+1));
+  db->nips = 0;
+  for (k = 0; k < db->nparts; k++) {
+    part = db->parts[k];
+    for (i = 0; i < part->nkeys; i++) {
+      memcpy(db->ips + next[gkey[k][i]], part->ips + part->ip_start[i], sizeof(IP *)*(part->ip_start[i+1] - part->ip_start[i]));
+      next[gkey[k][i]] += part->ip_start[i+1] - part->ip_start[i];
+    }
+    if (part->nips > db->nips) db->nips = part->nips;
+
+    /* The part's IPs and names live on in the merged index's arena. */
+
+    ArenaAdopt(&db->arena, &part->arena);
+    free(gkey[k]);
+    free(part->pending);
+    free(part->islots);
+    free(part->interned);
+    free(part->slots);
+    free(part->keys);
+    free(part->ip_start);
+    free(part->ips);
+    free(part);
+  }
+  free(gkey);
+  free(next);
+  free(db->parts);
+  db->parts = NULL;
+  db->nparts = 0;
+}
+
+/* @name: BuildKeys
+   @brief: Turns the loaded (name, IP) pairs into the multimap. Each distinct
+           name gets a key and a slot, and a counting sort on the keys packs
+           each name's IPs together. The sort is stable, so they stay in the
+           order they were read.
+   @param[in] db: The index. */
+
+void BuildKeys(HostDB *db) {
+  int *pair_key;
+  unsigned int h, i;
+  HostSlot *s;
+
+  /* Keep the table at most half full. */
+
+  db->nslots = 16;
+  while (db->nslots < 2 * (unsigned int) db->npairs) db->nslots *= 2;
+  db->slots = malloc(sizeof(HostSlot)*db->nslots);
+  for (i = 0; i < db->nslots; i++) db->slots[i].key = -1;
+  db->keys = malloc(sizeof(HostName)*(db->npairs+1));
+  db->nkeys = 0;
+
+  pair_key = malloc(sizeof(int)*(db->npairs+1));
+  for (i = 0; i < (unsigned int) db->npairs; i++) {
+    h = HashName(db->pair_name[i].s, db->pair_name[i].len);
+    s = FindSlot(db, db->pair_name[i].s, db->pair_name[i].len, h);
+    if (s->key == -1) {
+      s->hash = h;
+      s->key = db->nkeys;
+      db->keys[db->nkeys++] = db->pair_name[i];
+    }
+    pair_key[i] = s->key;
+  }
+
+  db->ip_start = calloc(db->nkeys+1, sizeof(int));
+  for (i = 0; i < (unsigned int) db->npairs; i++) db->ip_start[pair_key[i]+1]++;
+  for (i = 0; i < (unsigned int) db->nkeys; i++) db->ip_start[i+1] += db->ip_start[i];
+  db->ips = malloc(sizeof(IP *)*(db->npairs+1));
+  for (i = 0; i < (unsigned int) db->npairs; i++) db->ips[db->ip_start[pair_key[i]]++] = db->pair_ip[i];
+
+  /* The fill left each start at the next key's start, so shift them back. */
+
+  for (i = db->nkeys; i > 0; i--) db->ip_start[i] = db->ip_start[i-1];
+  db->ip_start[0] = 0;
+
+  free(pair_key);
+  free(db->pair_name);
+  free(db->pair_ip);
+  db->pair_name = NULL;
+  db->pair_ip = NULL;
+  db->npairs = db->pairs_cap = 0;
+}
+
+/* @name: HostDBBuild
+   @brief: Builds the index from what was loaded: the names from the pairs
+           (or by merging the parts), then the address trie and the sorted
+           names for wildcards.
+   @param[in] db: The index. */
+
+void HostDBBuild(HostDB *db) {
+  if (db->nparts > 0) {
+    MergeParts(db);
+  } else {
+    BuildKeys(db);
+  }
+  HostDBBuildAddrs(db);
+  HostDBBuildWild(db);
+}
+
+/* @name: HostDBFind
+   @brief: Looks up every IP with a host name.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] name: The host name.
+   @param[in] len: The length of the name.
+   @param[out] n: Set to the number of IPs.
+   @return: Returns the IPs, in the order they were read, or NULL if there are none. */
+
+IP **HostDBFind(HostDB *db, const char *name, int len, int *n) {
+  HostSlot *s;
+
+  s = FindSlot(db, name, len, HashName(name, len));
+  if (s->key == -1) {
+    *n = 0;
+    return NULL;
+  }
+  *n = db->ip_start[s->key+1] - db->ip_start[s->key];
+  return db->ips + db->ip_start[s->key];
+}
+
+/* @name: HostDBKey
+   @brief: Finds a name's key.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @return: Returns the key, which names db->keys and db->ip_start, or -1. */
+
+int HostDBKey(HostDB *db, const char *name, int len) {
+  return FindSlot(db, name, len, HashName(name, len))->key;
+}
+
+/* @name: PrintIP
+   @brief: Prints an IP's address and names on one line.
+   @param[in] ip: The IP. */
+
+void PrintIP(IP *ip) {
+  int j;
+
+  printf("%d.%d.%d.%d:", ip->address[0], ip->address[1], ip->address[2], ip->address[3]);
+  for (j = 0; j < ip->nnames; j++) printf(" %.*s", ip->names[j].len, ip->names[j].s);
+  printf("\n");
+}
+
+/* @name: HostDBFree
+   @brief: Frees an index, along with its arena and the file data it was
+           loaded from. Nothing from it may be used afterwards.
+   @param[in] db: The index. */
+
+void HostDBFree(HostDB *db) {
+  ArenaBlock *b, *next;
+
+  for (b = db->arena.block; b != NULL; b = next) {
+    next = b->next;
+    free(b);
+  }
+  if (db->data_mapped) {
+    if (db->data_size > 0) munmap(db->data, db->data_size);
+  } else {
+    free(db->data);
+  }
+  free(db->pair_name);
+  free(db->pair_ip);
+  free(db->keys);
+  free(db->ip_start);
+  free(db->ips);
+  free(db->slots);
+  free(db->by_addr);
+  free(db->anodes);
+  free(db->sorted);
+  free(db->rsorted);
+  free(db->pending);
+  free(db->islots);
+  free(db->interned);
+  free(db);
+}
+
+/* @name: RunQuery
+   @brief: Looks up every IP with a host name. An address or CIDR block (see
+           ParseAddr) finds every IP in it instead, and a pattern with a '*'
+           (see HostDBFindWild) finds every IP with a matching name.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] q: The query.
+   @param[out] n: Set to the number of IPs.
+   @param[out] owned: Set to 1 if the array is new and must be freed, else 0.
+   @return: Returns the IPs, or NULL if there are none. */
+
+IP **RunQuery(HostDB *db, char *q, int *n, int *owned) {
+  unsigned int addr;
+  int plen;
+
+  *owned = (strchr(q, '*') != NULL);
+  if (*owned) return HostDBFindWild(db, q, n);
+  if (ParseAddr(q, &addr, &plen) == 0) return HostDBFindAddr(db, addr, plen, n);
+  return HostDBFind(db, q, strlen(q), n);
+}
+
+/* @name: PrintQuery
+   @brief: Prints every IP a query finds (see RunQuery).
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] q: The query. */
+
+void PrintQuery(HostDB *db, char *q) {
+  IP **ips;
+  int i, n, owned;
+
+  ips = RunQuery(db, q, &n, &owned);
+  if (ips == NULL) printf("no key %s\n", q);
+  for (i = 0; i < n; i++) PrintIP(ips[i]);
+  if (owned) free(ips);
+}
+
+/* @name: PrintHosts
+   @brief: Reads host names from standard input until EOF, and prints every
+           IP with each one (see PrintQuery).
+   @param[in] db: The index, after HostDBBuild. */
+
+void PrintHosts(HostDB *db)
+{
+  char host_buf[1000];
+
+  while (fscanf(stdin, "%999s", host_buf) != EOF) {
+    PrintQuery(db, host_buf);
+	printf("\nEnter host name: ");
+  }
+}
@@ -0,0 +1,187 @@
+#ifndef HOSTDB_H_
+#define HOSTDB_H_
+
+#include <stddef.h>
+
+/* hostdb.h
+   Riley Crockett
+
+   The host index shared by l2p1.c through l2p4.c, l2p6.c and mkhostidx.c.
+   Each reads the 'converted' file its own way, and hands every IP it reads
+   to HostDBAdd.
+   HostDBBuild then turns the index into a hash multimap: every name has one
+   slot in an open-addressing table, and that slot leads to a contiguous array
+   of the IPs with the name, in the order they were read.
+
+   Names are spans, not NUL-terminated strings, so a loader can point them
+   straight into its input (see l2p4.c). A short name is the span of its full
+   name up to the first '.'.
+
+   HostDBBuild also sorts the IPs by address and builds a compressed radix
+   trie over them (see hostaddr.c), so an address or a CIDR block like
+   10.4.0.0/16 is answered by walking at most 32 bits down the trie to a
+   contiguous run of IPs. It sorts the names forwards and backwards too (see
+   hostwild.c), so "hydra*" or "*.cs.utk.edu" is a range of one of them.
+   */
+
+/* A name: len bytes at s. */
+
+typedef struct hostname {
+  const char *s;
+  int len;
+} HostName;
+
+/* A name found by ScanNames: len bytes at s, whose first '.' is at s[dot]
+   (dot is -1 if there is none). */
+
+typedef struct nametok {
+  const char *s;
+  int len;
+  int dot;
+} NameTok;
+
+/* This struct defines an IP with an address and list of names. It and its
+   names array live in its index's arena (see hostarena.c). */
+
+typedef struct ip {
+  unsigned char address[4];
+  int nnames;
+  int id;           /* The order HostDBAdd saw this IP in. */
+  HostName *names;
+} IP;
+
+/* A block of an arena. Its memory follows this header. */
+
+typedef struct arenablock {
+  struct arenablock *next;
+  size_t used;
+  size_t size;
+} ArenaBlock;
+
+/* An arena: the block being filled comes first. */
+
+typedef struct arena {
+  ArenaBlock *block;
+  size_t total;
+} Arena;
+
+/* A slot in the name table. It caches the name's hash so most probes never
+   touch the name itself. An empty slot has a key of -1. */
+
+typedef struct hostslot {
+  unsigned int hash;
+  int key;
+} HostSlot;
+
+/* A node of the address trie. Every address under it starts with the top
+   bits bits of prefix, and the IPs with them are by_addr[lo] up to
+   by_addr[hi]. An inner node splits them on the next bit; a leaf (bits of
+   32) holds a single address, and has no children. */
+
+typedef struct addrnode {
+  unsigned int prefix;
+  int bits;
+  int lo, hi;
+  int child[2];
+} AddrNode;
+
+/* This struct defines the host index. While loading, (name, IP) pairs are
+   appended in the order they are read, or a parallel loader leaves one built
+   index per range of the file in parts. After HostDBBuild, the IPs named
+   keys[k] are ips[ip_start[k]] up to ips[ip_start[k+1]]. */
+
+typedef struct hostdb {
+  HostName *pair_name;
+  IP **pair_ip;
+  int npairs;
+  int pairs_cap;
+  int nips;
+  struct hostdb **parts;  /* Built partial indexes, in file order, for HostDBBuild to merge. */
+  int nparts;
+
+  HostName *keys;
+  int nkeys;
+  int *ip_start;
+  IP **ips;
+
+  HostSlot *slots;
+  unsigned int nslots;    /* Always a power of two. */
+
+  IP **by_addr;           /* Every IP with a name, by address, then in the order read. */
+  int naddrs;
+  AddrNode *anodes;       /* anodes[0] is the root. */
+  int nanodes;
+
+  HostName **sorted;      /* The keys in byte order. */
+  HostName **rsorted;     /* The keys compared from the last byte back. */
+
+  Arena arena;            /* The IPs, their names arrays, and interned names. */
+  HostName *pending;      /* The names of the IP being loaded, until HostDBAdd. */
+  int npending;
+  int pending_cap;
+  HostSlot *islots;       /* The interned names, by hash; keys index interned. */
+  unsigned int nislots;
+  HostName *interned;
+  int ninterned;
+
+  void *data;             /* The 'converted' bytes the names point into, if any. */
+  size_t data_size;
+  int data_mapped;        /* Whether data is a mapping (else it was malloced). */
+} HostDB;
+
+/* What a loader did that /proc/self/io does not count: its seeks, its other
+   system calls (mmap, io_uring setup and enter), and the bytes io_uring
+   copied. Plain reads are counted there. */
+
+typedef struct iostats {
+  long seeks;
+  long calls;
+  long bytes;
+} IOStats;
+
+extern IOStats HostIO;
+
+unsigned int HashName(const char *name, int len);
+HostDB *NewHostDB();
+IP *NewIP(HostDB *db);
+void AddName(HostDB *db, const char *s, int len);
+void AddNames(HostDB *db, const char *s, int len, int dot);
+int ReadNames(HostDB *db, char *buf, int nnames, int prev_i, int i, int end);
+void ParseConverted(HostDB *db, const unsigned char *map, size_t size, int nthreads);
+int MapConverted(HostDB *db, char *file, int nthreads);
+int ReadConverted(HostDB *db, char *file, int nthreads);
+void HostDBAdd(HostDB *db, IP *ip);
+void BuildKeys(HostDB *db);
+void HostDBBuild(HostDB *db);
+IP **HostDBFind(HostDB *db, const char *name, int len, int *n);
+int HostDBKey(HostDB *db, const char *name, int len);
+void HostDBFree(HostDB *db);
+void PrintIP(IP *ip);
+IP **RunQuery(HostDB *db, char *q, int *n, int *owned);
+void PrintQuery(HostDB *db, char *q);
+void PrintHosts(HostDB *db);
+
+/* hostio.c */
+int LoadFread(HostDB *db, char *file);
+int LoadSyscalls(HostDB *db, char *file);
+int LoadOneRead(HostDB *db, char *file);
+int LoadUring(HostDB *db, char *file, int nthreads);
+
+/* hostarena.c */
+void *ArenaAlloc(Arena *a, size_t size);
+void ArenaAdopt(Arena *a, Arena *from);
+const char *InternName(HostDB *db, const char *s, int len);
+
+/* hostaddr.c */
+void HostDBBuildAddrs(HostDB *db);
+IP **HostDBFindAddr(HostDB *db, unsigned int addr, int plen, int *n);
+int ParseAddr(const char *s, unsigned int *addr, int *plen);
+
+/* hostwild.c */
+void HostDBBuildWild(HostDB *db);
+IP **HostDBFindWild(HostDB *db, const char *pat, int *n);
+
+/* nametok.c */
+int ScanNames(const char *s, const char *end, int max, NameTok *toks, const char **next);
+
+#endif // HOSTDB_H_
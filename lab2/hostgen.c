@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/* hostgen.c
+   Riley Crockett
+
+   This writes a synthetic 'converted' file, for benchmarking the lab2
+   loaders.
+
+   Usage: hostgen [-n records] [-u hosts] [-k max_names] [-z skew] [-d domains]
+                  [-s seed] > converted
+
+   Each record is a random address and 1 to max_names names. Each name
+   is one of hosts host names (a word and a number, like "hydra17"), picked
+   with a Zipf distribution: host r is picked in proportion to 1/r^skew, so 0
+   is uniform and bigger skews make a few hosts very common. About one name
+   in four has no domain; the rest get one of domains domains.
+   */
+
+/* The words host names are made from, and the domains they can have. */
+char *Words[] = { "alpha", "beta", "gamma", "delta", "hydra", "cetus", "vol", "arc", "tesla", "comet" };
+char *Domains[] = { ".utk.edu", ".eecs.utk.edu", ".cs.utk.edu", ".math.utk.edu", ".icl.utk.edu",
+                    ".ornl.gov", ".example.com", ".lab.example.com" };
+
+#define NWORDS (int) (sizeof(Words) / sizeof(Words[0]))
+#define NDOMAINS (int) (sizeof(Domains) / sizeof(Domains[0]))
+
+/* The state of the xorshift generator, so runs with the same seed match. */
+unsigned long long Seed = 88172645463325252ULL;
+
+/* @name: Random
+   @brief: Gets the next number from the xorshift generator.
+   @return: Returns a random 64-bit number. */
+
+unsigned long long Random() {
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 7;
+  Seed ^= Seed << 17;
+  return Seed;
+}
+
+/* @name: Uniform
+   @brief: Gets a random number in [0, 1).
+   @return: Returns it. */
+
+double Uniform() {
+  return (Random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* @name: PickHost
+   @brief: Picks a host with the Zipf distribution, by binary search on its
+           cumulative weights.
+   @param[in] cdf: cdf[r] is the total weight of hosts 0 through r.
+   @param[in] nhosts: The number of hosts.
+   @return: Returns the host. */
+
+int PickHost(double *cdf, int nhosts) {
+  double x;
+  int l, h, m;
+
+  x = Uniform() * cdf[nhosts-1];
+  l = 0;
+  h = nhosts - 1;
+  while (l < h) {
+    m = l + (h - l) / 2;
+    if (cdf[m] <= x) l = m + 1; else h = m;
+  }
+  return l;
+}
+
+int main(int argc, char **argv)
+{
+  long long n;     /* The number of records. */
+  int nhosts;      /* The number of distinct host names. */
+  int max_names;   /* The most names in a record. */
+  double skew;     /* The Zipf exponent. */
+  int ndomains;    /* The number of domains in use. */
+  double *cdf;
+  unsigned char head[8];
+  char name[64];
+  long long i;
+  int c, k, nnames, host, len;
+  unsigned long long a;
+
+  n = 100000;
+  nhosts = 10000;
+  max_names = 4;
+  skew = 1.0;
+  ndomains = 4;
+  while ((c = getopt(argc, argv, "n:u:k:z:d:s:")) != -1) {
+    if (c == 'n') {
+      n = atoll(optarg);
+    } else if (c == 'u') {
+      nhosts = atoi(optarg);
+    } else if (c == 'k') {
+      max_names = atoi(optarg);
+    } else if (c == 'z') {
+      skew = atof(optarg);
+    } else if (c == 'd') {
+      ndomains = atoi(optarg);
+    } else if (c == 's') {
+      Seed = strtoull(optarg, NULL, 10) * 2654435761ULL + 1;
+    } else {
+      fprintf(stderr, "usage: hostgen [-n records] [-u hosts] [-k max_names] [-z skew] [-d domains]\n");
+      fprintf(stderr, "               [-s seed] > converted\n");
+      exit(1);
+    }
+  }
+  if (n < 0 || nhosts < 1 || max_names < 1 || skew < 0 || ndomains < 1 || ndomains > NDOMAINS) {
+    fprintf(stderr, "hostgen: bad parameters (domains is 1 to %d)\n", NDOMAINS);
+    exit(1);
+  }
+
+  cdf = malloc(sizeof(double)*nhosts);
+  for (host = 0; host < nhosts; host++) {
+    cdf[host] = 1.0 / pow(host + 1, skew) + ((host > 0) ? cdf[host-1] : 0);
+  }
+
+  for (i = 0; i < n; i++) {
+    a = Random();
+    nnames = 1 + Random() % max_names;
+    head[0] = a >> 24;
+    head[1] = a >> 16;
+    head[2] = a >> 8;
+    head[3] = a;
+    head[4] = nnames >> 24;
+    head[5] = nnames >> 16;
+    head[6] = nnames >> 8;
+    head[7] = nnames;
+    fwrite(head, 1, 8, stdout);
+
+    for (k = 0; k < nnames; k++) {
+      host = PickHost(cdf, nhosts);
+      len = sprintf(name, "%s%d", Words[host % NWORDS], host / NWORDS);
+      if (Random() % 4 != 0) len += sprintf(name + len, "%s", Domains[host % ndomains]);
+      fwrite(name, 1, len + 1, stdout);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include "hostidx.h"
+
+/* hostidx.c
+   Riley Crockett
+
+   This writes and maps precompiled host indexes (see hostidx.h). The perfect
+   hash is built hash-and-displace style: names are hashed into about n/4
+   buckets, and the buckets are placed biggest first. For each bucket, seeds
+   are tried until every name in it hashes to a different free slot. Buckets
+   with one name go last, straight into whatever slots are left, so no slot is
+   wasted. If some bucket cannot be placed, the salt changes and it starts over.
+   */
+
+/* The number of seeds tried for one bucket before picking a new salt. */
+
+#define IDX_MAX_SEED 65536
+
+/* @name: Align8
+   @brief: Rounds a size up to a multiple of 8.
+   @param[in] size: The size.
+   @return: Returns the rounded size. */
+
+size_t Align8(size_t size) {
+  return (size + 7) & ~(size_t) 7;
+}
+
+/* @name: WriteSection
+   @brief: Writes one section of an index, padded out to 8 bytes.
+   @param[in] f: The index stream.
+   @param[in] data: The section, or NULL if it was already written and only needs padding.
+   @param[in] size: The section's size in bytes. */
+
+void WriteSection(FILE *f, const void *data, size_t size) {
+  static const char zeros[8] = { 0 };
+
+  if (data != NULL && size > 0) fwrite(data, 1, size, f);
+  fwrite(zeros, 1, Align8(size) - size, f);
+}
+
+/* @name: SeedHash
+   @brief: Hashes a name with 32-bit FNV-1a from a seeded basis, then mixes the
+           result (MurmurHash3's finalizer) so nearby seeds give unrelated hashes.
+   @param[in] name: The name.
+   @param[in] len: The length of the name.
+   @param[in] seed: The seed.
+   @return: Returns the hash. */
+
+unsigned int SeedHash(const char *name, int len, unsigned int seed) {
+  unsigned int h = 2166136261u ^ (seed * 0x9e3779b9u);
+  int i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/* @name: PlaceBuckets
+   @brief: Tries to build the perfect hash with one salt.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] salt: The salt.
+   @param[in] nbuckets: The number of buckets.
+   @param[out] seeds: Set to each bucket's seed.
+   @param[out] slot_of: Set to each key's slot.
+   @return: Returns 1 if every bucket was placed, otherwise 0. */
+
+int PlaceBuckets(HostDB *db, unsigned int salt, unsigned int nbuckets, int *seeds, int *slot_of) {
+  unsigned int n, b, i, j, k, seed, free_slot, size;
+  unsigned int *bucket_of, *start, *members, *by_size, *size_start, *slots;
+  char *taken;
+  int ok;
+
+  n = db->nkeys;
+  bucket_of = malloc(sizeof(unsigned int)*(n+1));
+  start = calloc(nbuckets+1, sizeof(unsigned int));
+  for (k = 0; k < n; k++) {
+    bucket_of[k] = SeedHash(db->keys[k].s, db->keys[k].len, salt) % nbuckets;
+    start[bucket_of[k]+1]++;
+  }
+
+  /* Group the keys by bucket, and the buckets by size, biggest first
+     (both with counting sorts). */
+
+  for (b = 0; b < nbuckets; b++) start[b+1] += start[b];
+  members = malloc(sizeof(unsigned int)*(n+1));
+  slots = malloc(sizeof(unsigned int)*(n+1));
+  for (k = 0; k < n; k++) members[start[bucket_of[k]]++] = k;
+  for (b = nbuckets; b > 0; b--) start[b] = start[b-1];
+  start[0] = 0;
+
+  size_start = calloc(n+2, sizeof(unsigned int));
+  for (b = 0; b < nbuckets; b++) size_start[n - (start[b+1] - start[b]) + 1]++;
+  for (i = 0; i <= n; i++) size_start[i+1] += size_start[i];
+  by_size = malloc(sizeof(unsigned int)*nbuckets);
+  for (b = 0; b < nbuckets; b++) by_size[size_start[n - (start[b+1] - start[b])]++] = b;
+
+  taken = calloc(n+1, 1);
+  free_slot = 0;
+  ok = 1;
+  for (i = 0; i < nbuckets && ok; i++) {
+    b = by_size[i];
+    size = start[b+1] - start[b];
+    if (size == 0) {
+      seeds[b] = 0;
+    } else if (size == 1) {
+      while (taken[free_slot]) free_slot++;
+      taken[free_slot] = 1;
+      slot_of[members[start[b]]] = free_slot;
+      seeds[b] = -(int) free_slot - 1;
+    } else {
+      for (seed = 1; seed <= IDX_MAX_SEED; seed++) {
+        for (j = 0; j < size; j++) {
+          k = members[start[b]+j];
+          slots[j] = SeedHash(db->keys[k].s, db->keys[k].len, salt + seed) % n;
+          if (taken[slots[j]]) break;
+          taken[slots[j]] = 2;
+        }
+        /* Undo the tentative marks; keep them only if every name found a slot. */
+        for (k = 0; k < j; k++) taken[slots[k]] = (j == size) ? 1 : 0;
+        if (j == size) break;
+      }
+      if (seed > IDX_MAX_SEED) {
+        ok = 0;
+      } else {
+        for (j = 0; j < size; j++) slot_of[members[start[b]+j]] = slots[j];
+        seeds[b] = seed;
+      }
+    }
+  }
+
+  free(bucket_of);
+  free(start);
+  free(members);
+  free(slots);
+  free(size_start);
+  free(by_size);
+  free(taken);
+  return ok;
+}
+
+/* @name: WriteHostIdx
+   @brief: Compiles a host index and writes it to file. It is written to
+           file.tmp and then renamed, so readers never see a partial index.
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] file: The index's file name. */
+
+void WriteHostIdx(HostDB *db, char *file) {
+  IdxHeader h;
+  FILE *f;
+  char *tmp;
+  int *seeds, *slot_of, *key_of;
+  IdxSpan *keys;
+  unsigned int *ip_start, *ips, *rec_off, *rec;
+  IP **by_id;
+  IP *ip;
+  unsigned int n, i, j, k, s, nwords, off;
+
+  memset(&h, 0, sizeof(IdxHeader));
+  strcpy(h.magic, IDX_MAGIC);
+  h.version = IDX_VERSION;
+  h.nkeys = n = db->nkeys;
+  h.nbuckets = n / 4 + 1;
+  h.nrefs = db->ip_start[n];
+
+  seeds = malloc(sizeof(int)*h.nbuckets);
+  slot_of = malloc(sizeof(int)*(n+1));
+  for (h.salt = 0; !PlaceBuckets(db, h.salt, h.nbuckets, seeds, slot_of); h.salt++) ;
+  key_of = malloc(sizeof(int)*(n+1));
+  for (k = 0; k < n; k++) key_of[slot_of[k]] = k;
+
+  /* Each slot's name goes in the string blob, and its IPs' records refer
+     to their names by slot. */
+
+  keys = malloc(sizeof(IdxSpan)*(n+1));
+  off = 0;
+  for (s = 0; s < n; s++) {
+    keys[s].off = off;
+    keys[s].len = db->keys[key_of[s]].len;
+    off += keys[s].len;
+  }
+  h.strings_size = off;
+
+  /* Lay out one record per IP, in the order they were read. */
+
+  by_id = calloc(db->nips+1, sizeof(IP *));
+  for (i = 0; i < h.nrefs; i++) by_id[db->ips[i]->id] = db->ips[i];
+  rec_off = malloc(sizeof(unsigned int)*(db->nips+1));
+  nwords = 0;
+  for (i = 0; i < (unsigned int) db->nips; i++) {
+    rec_off[i] = nwords * sizeof(unsigned int);
+    if (by_id[i] != NULL) nwords += 2 + 2 * by_id[i]->nnames;
+  }
+  h.records_size = nwords * sizeof(unsigned int);
+  rec = malloc(h.records_size + sizeof(unsigned int));
+  for (i = 0; i < (unsigned int) db->nips; i++) {
+    ip = by_id[i];
+    if (ip == NULL) continue;
+    j = rec_off[i] / sizeof(unsigned int);
+    memcpy(rec + j, ip->address, 4);
+    rec[j+1] = ip->nnames;
+    for (k = 0; k < (unsigned int) ip->nnames; k++) {
+      s = slot_of[HostDBKey(db, ip->names[k].s, ip->names[k].len)];
+      memcpy(rec + j + 2 + 2*k, &keys[s], sizeof(IdxSpan));
+    }
+  }
+
+  ip_start = malloc(sizeof(unsigned int)*(n+1));
+  ips = malloc(sizeof(unsigned int)*(h.nrefs+1));
+  ip_start[0] = 0;
+  for (s = 0; s < n; s++) {
+    k = key_of[s];
+    ip_start[s+1] = ip_start[s];
+    for (i = db->ip_start[k]; i < (unsigned int) db->ip_start[k+1]; i++) {
+      ips[ip_start[s+1]++] = rec_off[db->ips[i]->id];
+    }
+  }
+
+  tmp = malloc(strlen(file) + 5);
+  sprintf(tmp, "%s.tmp", file);
+  f = fopen(tmp, "w");
+  if (f == NULL) { perror(tmp); exit(1); }
+
+  WriteSection(f, &h, sizeof(IdxHeader));
+  WriteSection(f, seeds, sizeof(int)*h.nbuckets);
+  WriteSection(f, keys, sizeof(IdxSpan)*n);
+  WriteSection(f, ip_start, sizeof(unsigned int)*(n+1));
+  WriteSection(f, ips, sizeof(unsigned int)*h.nrefs);
+  WriteSection(f, rec, h.records_size);
+  for (s = 0; s < n; s++) fwrite(db->keys[key_of[s]].s, 1, keys[s].len, f);
+  WriteSection(f, NULL, h.strings_size);
+
+  if (ferror(f) || fclose(f) != 0 || rename(tmp, file) < 0) {
+    perror(file);
+    exit(1);
+  }
+
+  free(tmp);
+  free(seeds);
+  free(slot_of);
+  free(key_of);
+  free(keys);
+  free(by_id);
+  free(rec_off);
+  free(rec);
+  free(ip_start);
+  free(ips);
+}
+
+/* @name: CheckHostIdx
+   @brief: Checks that every seed, span and offset in a mapped index is in
+           range, so a damaged file is an error rather than a read out of bounds.
+   @param[in] x: The index, whose section sizes have been checked.
+   @return: Returns 1 if the index is sound, else 0. */
+
+int CheckHostIdx(HostIdx *x) {
+  IdxHeader *h = x->h;
+  const unsigned int *rec;
+  const IdxSpan *names;
+  unsigned char *start;
+  unsigned long long off, end;
+  unsigned int i, j;
+  int ok;
+
+  /* A seeded bucket hashes modulo nkeys; a direct one names its slot. */
+
+  for (i = 0; i < h->nbuckets; i++) {
+    if (x->seeds[i] > 0 && h->nkeys == 0) return 0;
+    if (x->seeds[i] < 0 && (unsigned int) (-(x->seeds[i] + 1)) >= h->nkeys) return 0;
+  }
+  for (i = 0; i < h->nkeys; i++) {
+    if ((unsigned long long) x->keys[i].off + x->keys[i].len > h->strings_size) return 0;
+    if (x->ip_start[i+1] < x->ip_start[i]) return 0;
+  }
+  if (x->ip_start[0] != 0 || x->ip_start[h->nkeys] > h->nrefs) return 0;
+
+  /* Walk the records, checking their names and noting where each starts,
+     and then make sure every IP offset is the start of one. */
+
+  start = calloc(h->records_size / sizeof(unsigned int) + 1, 1);
+  ok = 1;
+  for (off = 0; off < h->records_size && ok; off = end) {
+    if (h->records_size - off < 2 * sizeof(unsigned int)) { ok = 0; break; }
+    rec = (const unsigned int *) (x->records + off);
+    if (rec[1] > (h->records_size - off) / sizeof(IdxSpan) - 1) { ok = 0; break; }
+    end = off + sizeof(IdxSpan) * (rec[1] + 1ULL);
+    names = (const IdxSpan *) (rec + 2);
+    for (j = 0; j < rec[1]; j++) {
+      if ((unsigned long long) names[j].off + names[j].len > h->strings_size) ok = 0;
+    }
+    start[off / sizeof(unsigned int)] = 1;
+  }
+  for (i = 0; i < h->nrefs && ok; i++) {
+    if (x->ips[i] % sizeof(unsigned int) != 0 || x->ips[i] >= h->records_size
+        || !start[x->ips[i] / sizeof(unsigned int)]) ok = 0;
+  }
+  free(start);
+  return ok;
+}
+
+/* @name: LoadHostIdx
+   @brief: Maps an index file, checking that it is complete.
+   @param[in] file: The index's file name.
+   @return: Returns the index, or NULL (after printing why) if it cannot be used. */
+
+HostIdx *LoadHostIdx(char *file) {
+  HostIdx *x;
+  IdxHeader *h;
+  struct stat st;
+  char *map, *s;
+  size_t size;
+  int f;
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return NULL;
+  }
+  if (fstat(f, &st) == -1 || (size_t) st.st_size < sizeof(IdxHeader)) {
+    fprintf(stderr, "%s: not a host index\n", file);
+    close(f);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, f, 0);
+  close(f);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  h = (IdxHeader *) map;
+  if (memcmp(h->magic, IDX_MAGIC, sizeof(IDX_MAGIC)) || h->version != IDX_VERSION) {
+    fprintf(stderr, "%s: not a host index (or the wrong version)\n", file);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  if (h->records_size > (size_t) st.st_size || h->strings_size > (size_t) st.st_size) {
+    fprintf(stderr, "%s: truncated or corrupt host index\n", file);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  size = Align8(sizeof(IdxHeader)) + Align8(sizeof(int)*h->nbuckets)
+       + Align8(sizeof(IdxSpan)*h->nkeys) + Align8(sizeof(unsigned int)*(h->nkeys+1))
+       + Align8(sizeof(unsigned int)*h->nrefs) + Align8(h->records_size) + Align8(h->strings_size);
+  if (size != (size_t) st.st_size || h->nbuckets == 0) {
+    fprintf(stderr, "%s: truncated or corrupt host index\n", file);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  x = malloc(sizeof(HostIdx));
+  x->map = map;
+  x->map_size = st.st_size;
+  x->h = h;
+  s = map + Align8(sizeof(IdxHeader));
+  x->seeds = (int *) s;                   s += Align8(sizeof(int)*h->nbuckets);
+  x->keys = (IdxSpan *) s;                s += Align8(sizeof(IdxSpan)*h->nkeys);
+  x->ip_start = (unsigned int *) s;       s += Align8(sizeof(unsigned int)*(h->nkeys+1));
+  x->ips = (unsigned int *) s;            s += Align8(sizeof(unsigned int)*h->nrefs);
+  x->records = s;                         s += Align8(h->records_size);
+  x->strings = s;
+  if (!CheckHostIdx(x)) {
+    fprintf(stderr, "%s: truncated or corrupt host index\n", file);
+    munmap(map, st.st_size);
+    free(x);
+    return NULL;
+  }
+  return x;
+}
+
+/* @name: HostIdxFind
+   @brief: Looks up every IP with a host name.
+   @param[in] x: The index.
+   @param[in] name: The host name.
+   @param[in] len: The length of the name.
+   @param[out] n: Set to the number of IPs.
+   @return: Returns the offsets of the IPs' records, in the order they were
+            read, or NULL if there are none. */
+
+const unsigned int *HostIdxFind(HostIdx *x, const char *name, int len, int *n) {
+  unsigned int b, slot;
+  int seed;
+
+  *n = 0;
+  b = SeedHash(name, len, x->h->salt) % x->h->nbuckets;
+  seed = x->seeds[b];
+  if (seed == 0) return NULL;
+  slot = (seed < 0) ? (unsigned int) (-seed - 1) : SeedHash(name, len, x->h->salt + seed) % x->h->nkeys;
+  if (slot >= x->h->nkeys) return NULL;
+
+  /* A name that is not in the index still lands on some slot, so check it. */
+
+  if (x->keys[slot].len != (unsigned int) len || memcmp(x->strings + x->keys[slot].off, name, len)) return NULL;
+  *n = x->ip_start[slot+1] - x->ip_start[slot];
+  return x->ips + x->ip_start[slot];
+}
+
+/* @name: PrintIndexedHosts
+   @brief: Reads host names from standard input until EOF, and prints every
+           IP with each one, just like PrintHosts. The index only has names,
+           so address, CIDR and wildcard queries (see RunQuery) are refused.
+   @param[in] x: The index. */
+
+void PrintIndexedHosts(HostIdx *x)
+{
+  char host_buf[1000];
+  const unsigned int *offs, *rec;
+  const unsigned char *addr;
+  const IdxSpan *names;
+  unsigned int a;
+  int i, j, n, plen;
+
+  while (fscanf(stdin, "%999s", host_buf) != EOF) {
+    if (strchr(host_buf, '*') != NULL || ParseAddr(host_buf, &a, &plen) == 0) {
+      printf("not supported by the index: %s\n", host_buf);
+      n = 0;
+    } else {
+      offs = HostIdxFind(x, host_buf, strlen(host_buf), &n);
+      if (offs == NULL) printf("no key %s\n", host_buf);
+    }
+    for (i = 0; i < n; i++) {
+      rec = (const unsigned int *) (x->records + offs[i]);
+      addr = (const unsigned char *) rec;
+      names = (const IdxSpan *) (rec + 2);
+      printf("%d.%d.%d.%d:", addr[0], addr[1], addr[2], addr[3]);
+      for (j = 0; j < (int) rec[1]; j++) printf(" %.*s", (int) names[j].len, x->strings + names[j].off);
+      printf("\n");
+    }
+	printf("\nEnter host name: ");
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef HOSTIDX_H_
+#define HOSTIDX_H_
+
+#include <stddef.h>
+#include "hostdb.h"
+
+/* hostidx.h
+   Riley Crockett
+
+   A host index compiled ahead of time (by mkhostidx) so lookup programs can
+   map it and answer at once, instead of reading 'converted' and building a
+   HostDB on every start. Every name (full and short) gets one slot in a
+   minimal perfect hash: n names fill exactly n slots, and a name is found by
+   hashing it into a bucket, then hashing it again with that bucket's seed.
+
+   Layout (native byte order; every section starts on an 8-byte boundary):
+     IdxHeader
+     seeds[nbuckets]         (int: a bucket's seed, or -slot-1 for a bucket
+                              with one name, which is put in slot directly)
+     keys[nkeys]             (IdxSpan: each slot's name, in the string blob)
+     ip_start[nkeys+1]       (unsigned int: slot k's IPs are
+                              ips[ip_start[k]] up to ips[ip_start[k+1]])
+     ips[nrefs]              (unsigned int: offsets of IP records)
+     records                 (records_size bytes: for each IP, its address,
+                              an unsigned int name count, and that many IdxSpans)
+     strings                 (strings_size bytes of names)
+   */
+
+#define IDX_MAGIC "HOSTIDX"
+#define IDX_VERSION 1
+
+/* This struct defines the start of an index file. */
+
+typedef struct idxheader {
+  char magic[8];
+  unsigned int version;
+  unsigned int nkeys;
+  unsigned int nbuckets;
+  unsigned int nrefs;
+  unsigned int salt;       /* Mixed into the bucket hash; chosen by the compiler. */
+  unsigned int pad;
+  unsigned long long records_size;
+  unsigned long long strings_size;
+} IdxHeader;
+
+/* A name in the index's string blob. */
+
+typedef struct idxspan {
+  unsigned int off;
+  unsigned int len;
+} IdxSpan;
+
+/* This struct defines a mapped index. Its arrays all point into the map. */
+
+typedef struct hostidx {
+  void *map;
+  size_t map_size;
+  IdxHeader *h;
+  int *seeds;
+  IdxSpan *keys;
+  unsigned int *ip_start;
+  unsigned int *ips;
+  const char *records;
+  const char *strings;
+} HostIdx;
+
+void WriteHostIdx(HostDB *db, char *file);
+HostIdx *LoadHostIdx(char *file);
+const unsigned int *HostIdxFind(HostIdx *x, const char *name, int len, int *n);
+void PrintIndexedHosts(HostIdx *x);
+
+#endif // HOSTIDX_H_
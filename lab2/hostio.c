@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include "hostdb.h"
+
+/* hostio.c
+   Riley Crockett
+
+   The ways of reading the 'converted' file that the lab2 programs compare,
+   kept here so that hostbench times exactly the code the programs run:
+     LoadFread     buffered stdio, a record at a time (l2p1)
+     LoadSyscalls  read and lseek, a record at a time (l2p2)
+     LoadOneRead   one read of the whole file (l2p3)
+     LoadUring     the whole file in big reads kept in flight with io_uring
+   MapConverted and ReadConverted (in hostdb.c) are the other two.
+
+   Every loader reads a record's name count as 4 big-endian bytes, as
+   ParseRecords does. The record-at-a-time loaders read a 4-byte address, the
+   count, and then BUFSZ bytes, doubling that until it holds all the names,
+   and seek back past whatever the names didn't use. Their names are copied
+   out of the buffer (see ReadNames).
+
+   Every loader counts the seeks and other calls it makes in HostIO (see
+   hostdb.h), for what /proc/self/io does not count.
+   */
+
+#define BUFSZ 200
+
+/* LoadUring keeps URING_DEPTH reads of URING_CHUNK bytes in flight. */
+#define URING_DEPTH 8
+#define URING_CHUNK (1 << 20)
+
+/* This struct defines an io_uring's shared rings, mapped from the kernel. */
+
+typedef struct uring {
+  int fd;
+  unsigned int *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map, *cq_map;
+  size_t sq_size, cq_size, sqes_size;
+} URing;
+
+/* @name: NameCount
+   @brief: Reads a record's big-endian name count.
+   @param[in] num_names: The count's 4 bytes.
+   @return: Returns the count, or 0 if it is too big to be real. */
+
+int NameCount(char *num_names) {
+  const unsigned char *p = (const unsigned char *) num_names;
+  unsigned int n;
+
+  n = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  return (n > INT_MAX) ? 0 : (int) n;
+}
+
+/* @name: NamesEnd
+   @brief: Finds where a record's names end in a buffer.
+   @param[in] buf: The names.
+   @param[in] len: The number of bytes in the buffer.
+   @param[in] nnames: The number of names.
+   @return: Returns the offset just past the last name's NUL, or -1 if the
+            buffer ends first. */
+
+int NamesEnd(const char *buf, int len, int nnames) {
+  const char *p, *end;
+
+  p = buf;
+  end = buf + len;
+  for (; nnames > 0; nnames--) {
+    p = memchr(p, '\0', end - p);
+    if (p == NULL) return -1;
+    p++;
+  }
+  return p - buf;
+}
+
+/* @name: LoadFread
+   @brief: Adds every IP in a 'converted' file to the index using buffered
+           I/O routines.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @return: Returns 0, or -1 if the file could not be opened. */
+
+int LoadFread(HostDB *db, char *file) {
+  FILE *f;
+  IP *ip;
+  int i, buf_index, nnames, want, cap;
+  char *buf;
+  char num_names[4];
+
+  f = fopen(file, "r");
+  if (f == NULL) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+
+  cap = BUFSZ;
+  buf = malloc(cap);
+  i = 1;
+  while (i > 0) {
+    /* Initialize an IP, then read and set the address. */
+    ip = NewIP(db);
+    if (i > 0) i = fread(ip->address, 1, 4, f);
+
+    /* Read the bytes for the number of names, then convert them to an integer. */
+    if (i > 0) i = fread(num_names, 1, 4, f);
+    nnames = NameCount(num_names);
+
+    /* Read names into the buffer, reading more while the last one isn't in
+       it, then seek back to the end of the last one. */
+    want = BUFSZ;
+    if (i > 0) i = fread(buf, 1, want, f);
+    while (i == want && want <= INT_MAX / 2 && NamesEnd(buf, i, nnames) == -1) {
+      want *= 2;
+      if (want > cap) {
+        cap = want;
+        buf = realloc(buf, cap);
+      }
+      i += fread(buf + i, 1, want - i, f);
+    }
+    buf_index = ReadNames(db, buf, nnames, 0, 0, i);
+    fseek(f, buf_index-i, SEEK_CUR);
+    HostIO.seeks++;
+
+    /* Make an entry in the index for each name. */
+    HostDBAdd(db, ip);
+  }
+  fclose(f);
+  free(buf);
+  return 0;
+}
+
+/* @name: LoadSyscalls
+   @brief: Adds every IP in a 'converted' file to the index using the system
+           calls open, close, read and lseek.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @return: Returns 0, or -1 if the file could not be opened. */
+
+int LoadSyscalls(HostDB *db, char *file) {
+  IP *ip;
+  int f, i, n, buf_index, nnames, want, cap;
+  char *buf;
+  char num_names[4];
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+
+  cap = BUFSZ;
+  buf = malloc(cap);
+  i = 1;
+  while (i > 0) {
+    ip = NewIP(db);
+    if (i > 0) i = read(f, ip->address, 4);
+    if (i > 0) i = read(f, num_names, 4);
+    nnames = NameCount(num_names);
+    want = BUFSZ;
+    if (i > 0) i = read(f, buf, want);
+    while (i == want && want <= INT_MAX / 2 && NamesEnd(buf, i, nnames) == -1) {
+      want *= 2;
+      if (want > cap) {
+        cap = want;
+        buf = realloc(buf, cap);
+      }
+      n = read(f, buf + i, want - i);
+      if (n <= 0) break;
+      i += n;
+    }
+    buf_index = ReadNames(db, buf, nnames, 0, 0, i);
+    lseek(f, buf_index-i, SEEK_CUR);
+    HostIO.seeks++;
+    HostDBAdd(db, ip);
+  }
+  close(f);
+  free(buf);
+  return 0;
+}
+
+/* @name: LoadOneRead
+   @brief: Adds every IP in a 'converted' file to the index, reading the
+           whole file into memory first. That is one read, unless the file
+           is bigger than the kernel will return at once (about 2 GB), in
+           which case the reads continue until it is all in. The names are
+           still copied out, as with the other two l2p loaders, and the
+           buffer is freed.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @return: Returns 0, or -1 if the file could not be opened or read. */
+
+int LoadOneRead(HostDB *db, char *file) {
+  IP *ip;
+  struct stat st;
+  size_t size, i, len;
+  ssize_t n;
+  int f, nnames;
+  char *buffer;
+  char num_names[4];
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+  if (fstat(f, &st) == -1) {
+    perror(file);
+    close(f);
+    return -1;
+  }
+  buffer = malloc(st.st_size + 1);
+  size = 0;
+  while (size < (size_t) st.st_size) {
+    n = read(f, buffer + size, st.st_size - size);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      perror(file);
+      close(f);
+      free(buffer);
+      return -1;
+    }
+    if (n == 0) break;
+    size += n;
+  }
+  close(f);
+
+  i = 0;
+  while (size - i >= 8) {
+    /* Initialize an IP, then read and set the address. */
+    ip = NewIP(db);
+    memcpy(ip->address, buffer+i, 4);
+    i += 4;
+
+    /* Read the bytes for the number of names, then convert them to an integer. */
+    memcpy(num_names, buffer+i, 4);
+    i += 4;
+    nnames = NameCount(num_names);
+
+    /* Read names relative to the record, so the offsets fit ReadNames
+       whatever the file's size. */
+    len = (size - i > INT_MAX) ? INT_MAX : size - i;
+    i += ReadNames(db, buffer + i, nnames, 0, 0, len);
+
+    /* Make an entry in the index for each name. */
+    HostDBAdd(db, ip);
+  }
+  free(buffer);
+  return 0;
+}
+
+/* @name: UringSetup
+   @brief: Creates an io_uring and maps its rings.
+   @param[in] r: The ring to set up.
+   @param[in] entries: The most requests in flight.
+   @return: Returns 0, or -1 if the kernel won't make one. */
+
+int UringSetup(URing *r, unsigned int entries) {
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) return -1;
+  HostIO.calls++;
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sq_map = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cq_map = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  HostIO.calls += 3;
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+    close(r->fd);
+    return -1;
+  }
+
+  r->sq_tail = (unsigned int *) ((char *) r->sq_map + p.sq_off.tail);
+  r->sq_mask = (unsigned int *) ((char *) r->sq_map + p.sq_off.ring_mask);
+  r->sq_array = (unsigned int *) ((char *) r->sq_map + p.sq_off.array);
+  r->cq_head = (unsigned int *) ((char *) r->cq_map + p.cq_off.head);
+  r->cq_tail = (unsigned int *) ((char *) r->cq_map + p.cq_off.tail);
+  r->cq_mask = (unsigned int *) ((char *) r->cq_map + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) ((char *) r->cq_map + p.cq_off.cqes);
+  return 0;
+}
+
+/* @name: UringRead
+   @brief: Queues a read (it is submitted by the next io_uring_enter).
+   @param[in] r: The ring.
+   @param[in] fd: The file.
+   @param[in] buf: Where the bytes go.
+   @param[in] len: The number of bytes.
+   @param[in] off: The file offset, which is also the request's tag. */
+
+void UringRead(URing *r, int fd, char *buf, unsigned int len, unsigned long long off) {
+  struct io_uring_sqe *sqe;
+  unsigned int tail, k;
+
+  tail = *r->sq_tail;
+  k = tail & *r->sq_mask;
+  sqe = &r->sqes[k];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) buf;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = off;
+  r->sq_array[k] = k;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* @name: LoadUring
+   @brief: Reads a whole 'converted' file into memory with io_uring, keeping
+           URING_DEPTH reads of URING_CHUNK bytes in flight, and adds every
+           IP in it to the index (see ParseConverted). The names point into
+           the copy, which lasts until HostDBFree.
+   @param[in] db: The index, before HostDBBuild.
+   @param[in] file: The file's name.
+   @param[in] nthreads: The number of parser threads.
+   @return: Returns 0, or -1 if the file could not be read or the kernel has
+            no io_uring. */
+
+int LoadUring(HostDB *db, char *file, int nthreads) {
+  URing r;
+  struct stat st;
+  struct io_uring_cqe *cqe;
+  unsigned long long next, off, end, size;
+  unsigned int head, queued;
+  int f, inflight, res, err;
+  char *buf;
+
+  f = open(file, O_RDONLY);
+  if (f == -1) {
+    fprintf(stderr, "file name: '%s' not found.\n", file);
+    return -1;
+  }
+  if (fstat(f, &st) == -1) {
+    perror(file);
+    close(f);
+    return -1;
+  }
+  if (UringSetup(&r, URING_DEPTH) == -1) {
+    perror("io_uring_setup");
+    close(f);
+    return -1;
+  }
+  size = st.st_size;
+  buf = malloc(size + 1);
+
+  /* Each chunk is read once, plus once more for any short read's rest. A
+     read that finds the end early means the file shrank, so stop there. */
+
+  next = 0;
+  inflight = 0;
+  queued = 0;
+  err = 0;
+  while (next < size || inflight > 0) {
+    while (next < size && inflight < URING_DEPTH) {
+      end = (next + URING_CHUNK < size) ? next + URING_CHUNK : size;
+      UringRead(&r, f, buf + next, end - next, next);
+      next = end;
+      inflight++;
+      queued++;
+    }
+    syscall(__NR_io_uring_enter, r.fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    HostIO.calls++;
+    queued = 0;
+
+    head = *r.cq_head;
+    while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = &r.cqes[head & *r.cq_mask];
+      off = cqe->user_data;
+      res = cqe->res;
+      head++;
+      inflight--;
+      end = (off / URING_CHUNK + 1) * URING_CHUNK;
+      if (end > size) end = size;
+      if (res < 0) {
+        err = -res;
+      } else if (res == 0) {
+        if (off < size) size = off;
+      } else {
+        HostIO.bytes += res;
+        if (off + res < end) {
+          UringRead(&r, f, buf + off + res, end - off - res, off + res);
+          inflight++;
+          queued++;
+        }
+      }
+    }
+    __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    if (next > size) next = size;
+  }
+
+  munmap(r.sqes, r.sqes_size);
+  munmap(r.cq_map, r.cq_size);
+  munmap(r.sq_map, r.sq_size);
+  close(r.fd);
+  close(f);
+  if (err != 0) {
+    fprintf(stderr, "%s: %s\n", file, strerror(err));
+    free(buf);
+    return -1;
+  }
+
+  db->data = buf;
+  db->data_size = size;
+  db->data_mapped = 0;
+  ParseConverted(db, (unsigned char *) buf, size, nthreads);
+  return 0;
+}
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "sockettome.h"
+
+/* hostload.c
+   Riley Crockett
+
+   This program is a load generator for hostd. Each of its connections runs
+   on its own thread and sends queries from a file round-robin, keeping up
+   to depth of them in flight (pipelined) at once. The time from sending a
+   query to reading the end of its answer is its latency. When every
+   connection is done, it prints the total queries per second and the
+   median, p99 and worst latencies.
+
+   Usage: hostload [-c connections] [-n queries] [-d depth] host port queryfile
+          (-n is per connection.)
+   */
+
+/* This struct defines one connection's run. */
+
+typedef struct client {
+  char *host;
+  int port;
+  char **queries;
+  int nqueries;
+  int first;          /* The query this connection starts at. */
+  int count;          /* How many queries to send. */
+  int depth;
+  double *lat;        /* Each query's latency, in microseconds. */
+  int errors;
+} Client;
+
+/* @name: Now
+   @brief: Reads the monotonic clock.
+   @return: Returns the time in microseconds. */
+
+double Now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* @name: CompareDoubles
+   @brief: The qsort comparator for latencies.
+   @param[in] a, b: Pointers to doubles.
+   @return: Returns <0, 0 or >0. */
+
+int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* @name: RunClient
+   @brief: The start routine of pthread_create for the connections. This
+           keeps depth queries in flight until count answers have come back.
+           Answers come back in order, so the i-th answer is the i-th query's.
+   @param[in] arg: The client. */
+
+void *RunClient(void *arg) {
+  Client *cl = (Client *) arg;
+  double *sent;
+  char *line;
+  size_t line_cap;
+  FILE *in;
+  int fd, nsent, ndone, n, k, one;
+  char *q;
+
+  /* Each query is its own small write, so don't let Nagle hold them back. */
+
+  fd = request_connection(cl->host, cl->port);
+  one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  in = fdopen(dup(fd), "r");
+  sent = malloc(sizeof(double)*cl->depth);
+  line = NULL;
+  line_cap = 0;
+
+  nsent = 0;
+  for (ndone = 0; ndone < cl->count; ndone++) {
+
+    /* Fill the window, then wait for its oldest answer. */
+
+    while (nsent < cl->count && nsent - ndone < cl->depth) {
+      q = cl->queries[(cl->first + nsent) % cl->nqueries];
+      sent[nsent % cl->depth] = Now();
+      if (write(fd, q, strlen(q)) == -1) {
+        perror("write");
+        cl->errors++;
+        break;
+      }
+      nsent++;
+    }
+    if (cl->errors > 0) break;
+
+    if (getline(&line, &line_cap, in) == -1 || sscanf(line, "OK %d", &n) != 1) {
+      fprintf(stderr, "hostload: bad or missing answer\n");
+      cl->errors++;
+      break;
+    }
+    for (k = 0; k < n; k++) {
+      if (getline(&line, &line_cap, in) == -1) break;
+    }
+    cl->lat[ndone] = Now() - sent[ndone % cl->depth];
+  }
+  cl->count = ndone;
+
+  fclose(in);
+  close(fd);
+  free(sent);
+  free(line);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  Client *cl;
+  pthread_t *tids;
+  FILE *f;
+  char **queries, *line, *nl;
+  size_t line_cap;
+  double start, secs, *all;
+  long total;
+  int nconns, count, depth, nqueries, qcap, c, i;
+
+  nconns = 4;
+  count = 10000;
+  depth = 16;
+  while ((c = getopt(argc, argv, "c:n:d:")) != -1) {
+    if (c == 'c') {
+      nconns = atoi(optarg);
+    } else if (c == 'n') {
+      count = atoi(optarg);
+    } else if (c == 'd') {
+      depth = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: hostload [-c connections] [-n queries] [-d depth] host port queryfile\n");
+      exit(1);
+    }
+  }
+  if (argc - optind != 3 || nconns < 1 || count < 1 || depth < 1) {
+    fprintf(stderr, "usage: hostload [-c connections] [-n queries] [-d depth] host port queryfile\n");
+    exit(1);
+  }
+
+  /* Read the queries, one per line, keeping their newlines for sending. */
+
+  f = fopen(argv[optind+2], "r");
+  if (f == NULL) {
+    perror(argv[optind+2]);
+    exit(1);
+  }
+  queries = NULL;
+  nqueries = qcap = 0;
+  line = NULL;
+  line_cap = 0;
+  while (getline(&line, &line_cap, f) != -1) {
+    nl = strchr(line, '\n');
+    if (nl != NULL) *nl = '\0';
+    if (line[0] == '\0') continue;
+    if (nqueries == qcap) {
+      qcap = (qcap == 0) ? 64 : qcap * 2;
+      queries = realloc(queries, sizeof(char *)*qcap);
+    }
+    queries[nqueries] = malloc(strlen(line) + 2);
+    sprintf(queries[nqueries], "%s\n", line);
+    nqueries++;
+  }
+  fclose(f);
+  free(line);
+  if (nqueries == 0) {
+    fprintf(stderr, "hostload: no queries in %s\n", argv[optind+2]);
+    exit(1);
+  }
+
+  /* A connection the server drops should end only that connection. */
+
+  signal(SIGPIPE, SIG_IGN);
+  cl = calloc(nconns, sizeof(Client));
+  tids = malloc(sizeof(pthread_t)*nconns);
+  start = Now();
+  for (i = 0; i < nconns; i++) {
+    cl[i].host = argv[optind];
+    cl[i].port = atoi(argv[optind+1]);
+    cl[i].queries = queries;
+    cl[i].nqueries = nqueries;
+    cl[i].first = i * (nqueries / nconns + 1);
+    cl[i].count = count;
+    cl[i].depth = depth;
+    cl[i].lat = malloc(sizeof(double)*count);
+    pthread_create(&tids[i], NULL, RunClient, cl+i);
+  }
+  for (i = 0; i < nconns; i++) pthread_join(tids[i], NULL);
+  secs = (Now() - start) / 1e6;
+
+  /* Pool every connection's latencies for the percentiles. */
+
+  total = 0;
+  for (i = 0; i < nconns; i++) total += cl[i].count;
+  all = malloc(sizeof(double)*(total+1));
+  total = 0;
+  for (i = 0; i < nconns; i++) {
+    memcpy(all + total, cl[i].lat, sizeof(double)*cl[i].count);
+    total += cl[i].count;
+    if (cl[i].errors > 0) fprintf(stderr, "hostload: connection %d stopped early\n", i);
+  }
+  if (total == 0) {
+    fprintf(stderr, "hostload: no answers\n");
+    exit(1);
+  }
+  qsort(all, total, sizeof(double), CompareDoubles);
+
+  printf("%d connections, depth %d: %ld queries in %.3f s\n", nconns, depth, total, secs);
+  printf("%.0f queries/s\n", total / secs);
+  printf("latency (us): p50 %.1f  p99 %.1f  max %.1f\n",
+         all[total / 2], all[(long) (total * 0.99)], all[total - 1]);
+  return 0;
+}
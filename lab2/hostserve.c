@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include "hostserve.h"
+
+/* hostserve.c
+   Riley Crockett
+
+   This keeps a served host index in step with its 'converted' file (see
+   hostserve.h). Each index is loaded with ReadConverted rather than mapped,
+   so a file rewritten in place can never change an index that readers are
+   still using.
+   */
+
+#define QUIET_MS 200
+
+/* @name: LoadIndex
+   @brief: Loads and builds a whole index from the server's file.
+   @param[in] srv: The server.
+   @return: Returns the index, or NULL if the file could not be read. */
+
+HostDB *LoadIndex(HostServer *srv) {
+  HostDB *db;
+
+  db = NewHostDB();
+  if (ReadConverted(db, srv->file, srv->nthreads) == -1) {
+    HostDBFree(db);
+    return NULL;
+  }
+  HostDBBuild(db);
+  return db;
+}
+
+/* @name: WaitForReaders
+   @brief: Waits until no reader can still hold an index published before an
+           epoch: every reader is idle, or entered at that epoch or later.
+   @param[in] srv: The server.
+   @param[in] epoch: The epoch. */
+
+void WaitForReaders(HostServer *srv, unsigned long epoch) {
+  struct timespec nap;
+  unsigned long e;
+  int r, n;
+
+  nap.tv_sec = 0;
+  nap.tv_nsec = 100000;
+  n = __atomic_load_n(&srv->nreaders, __ATOMIC_SEQ_CST);
+  if (n > MAX_READERS) n = MAX_READERS;
+  for (r = 0; r < n; r++) {
+    while (1) {
+      e = __atomic_load_n(&srv->readers[r].epoch, __ATOMIC_SEQ_CST);
+      if (e == 0 || e >= epoch) break;
+      nanosleep(&nap, NULL);
+    }
+  }
+}
+
+/* @name: Reload
+   @brief: Builds a new index, publishes it, and frees the old one once no
+           reader can be using it. If the file can't be read, the old index
+           stays.
+   @param[in] srv: The server. */
+
+void Reload(HostServer *srv) {
+  HostDB *db, *old;
+  unsigned long epoch;
+
+  db = LoadIndex(srv);
+  if (db == NULL) {
+    fprintf(stderr, "%s: reload failed; still serving the old index\n", srv->file);
+    return;
+  }
+
+  /* A reader that entered before the bump may have the old index. One that
+     enters after it reads the pointer after the swap, so it has the new one. */
+
+  old = __atomic_exchange_n(&srv->current, db, __ATOMIC_SEQ_CST);
+  epoch = __atomic_add_fetch(&srv->epoch, 1, __ATOMIC_SEQ_CST);
+  WaitForReaders(srv, epoch);
+  HostDBFree(old);
+
+  fprintf(stderr, "%s reloaded: %d names, %d IPs\n", srv->file, db->nkeys, db->nips);
+}
+
+/* @name: Touched
+   @brief: Checks a batch of inotify events for the server's file.
+   @param[in] srv: The server.
+   @param[in] buf: The events.
+   @param[in] n: The number of bytes of them.
+   @return: Returns 1 if any event names the file, else 0. */
+
+int Touched(HostServer *srv, char *buf, ssize_t n) {
+  struct inotify_event *ev;
+  char *p;
+
+  for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+    ev = (struct inotify_event *) p;
+    if (ev->len > 0 && strcmp(ev->name, srv->base) == 0) return 1;
+  }
+  return 0;
+}
+
+/* @name: WatchThread
+   @brief: The start routine of pthread_create for the reloader. This reads
+           inotify events on the file's directory until the program exits.
+           A file written in place shows up when it is closed, and a file
+           replaced by rename when it is moved in. Either way, the reload
+           waits until the file has been left alone for QUIET_MS, so a
+           writer that rewrites it in several passes causes one reload, not
+           one of each pass.
+   @param[in] arg: The server. */
+
+void *WatchThread(void *arg) {
+  HostServer *srv = (HostServer *) arg;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd;
+  ssize_t n;
+
+  pfd.fd = srv->inotify_fd;
+  pfd.events = POLLIN;
+  while (1) {
+    n = read(srv->inotify_fd, buf, sizeof(buf));
+    if (n <= 0) {
+      perror("inotify");
+      return NULL;
+    }
+    if (!Touched(srv, buf, n)) continue;
+
+    while (poll(&pfd, 1, QUIET_MS) > 0) {
+      if (read(srv->inotify_fd, buf, sizeof(buf)) <= 0) break;
+    }
+    Reload(srv);
+  }
+}
+
+/* @name: FreeHostServer
+   @brief: Frees a server that never started watching, along with its index
+           and inotify descriptor if it got that far.
+   @param[in] srv: The server. */
+
+void FreeHostServer(HostServer *srv) {
+  if (srv->current != NULL) HostDBFree(srv->current);
+  if (srv->inotify_fd != -1) close(srv->inotify_fd);
+  free(srv->dir);
+  free(srv->file);
+  free(srv);
+}
+
+/* @name: StartHostServer
+   @brief: Loads a file's index and starts watching the file.
+   @param[in] file: The 'converted' file.
+   @param[in] nthreads: The number of loader threads for each load.
+   @return: Returns the server, or NULL if the file could not be read or
+            watched, or the watcher could not be started. */
+
+HostServer *StartHostServer(char *file, int nthreads) {
+  HostServer *srv;
+  char *slash;
+  int err;
+
+  srv = calloc(1, sizeof(HostServer));
+  srv->file = strdup(file);
+  srv->nthreads = nthreads;
+  srv->epoch = 1;
+
+  /* Watch the directory, not the file: a file replaced by rename is a new
+     inode, and a watch on the old one would never fire again. */
+
+  slash = strrchr(srv->file, '/');
+  if (slash == NULL) {
+    srv->dir = strdup(".");
+    srv->base = srv->file;
+  } else {
+    srv->dir = strndup(srv->file, (slash == srv->file) ? 1 : slash - srv->file);
+    srv->base = slash + 1;
+  }
+
+  srv->inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (srv->inotify_fd == -1 || inotify_add_watch(srv->inotify_fd, srv->dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+    perror(srv->dir);
+    FreeHostServer(srv);
+    return NULL;
+  }
+
+  srv->current = LoadIndex(srv);
+  if (srv->current == NULL) {
+    FreeHostServer(srv);
+    return NULL;
+  }
+
+  err = pthread_create(&srv->tid, NULL, WatchThread, srv);
+  if (err != 0) {
+    fprintf(stderr, "%s: can't start the watcher: %s\n", srv->file, strerror(err));
+    FreeHostServer(srv);
+    return NULL;
+  }
+  pthread_detach(srv->tid);
+  return srv;
+}
+
+/* @name: HostReaderRegister
+   @brief: Gives a query thread its reader slot.
+   @param[in] srv: The server.
+   @return: Returns the slot, or -1 if all MAX_READERS are taken. */
+
+int HostReaderRegister(HostServer *srv) {
+  int r;
+
+  r = __atomic_fetch_add(&srv->nreaders, 1, __ATOMIC_SEQ_CST);
+  return (r < MAX_READERS) ? r : -1;
+}
+
+/* @name: HostReadLock
+   @brief: Enters a query. The index it returns stays valid until
+           HostReadUnlock, even if a newer one is published meanwhile.
+           This never blocks.
+   @param[in] srv: The server.
+   @param[in] reader: The reader's slot.
+   @return: Returns the current index. */
+
+HostDB *HostReadLock(HostServer *srv, int reader) {
+  __atomic_store_n(&srv->readers[reader].epoch, __atomic_load_n(&srv->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&srv->current, __ATOMIC_SEQ_CST);
+}
+
+/* @name: HostReadUnlock
+   @brief: Leaves a query. The index from HostReadLock may be freed after this.
+   @param[in] srv: The server.
+   @param[in] reader: The reader's slot. */
+
+void HostReadUnlock(HostServer *srv, int reader) {
+  __atomic_store_n(&srv->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
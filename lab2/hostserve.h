@@ -0,0 +1,54 @@
+#ifndef HOSTSERVE_H_
+#define HOSTSERVE_H_
+
+#include <pthread.h>
+#include "hostdb.h"
+
+/* hostserve.h
+   Riley Crockett
+
+   A host index that follows its 'converted' file. A background thread
+   watches the file's directory with inotify, and whenever the file is
+   written or replaced, it builds a whole new index off to the side and
+   publishes it with one atomic pointer swap. Query threads never block on
+   it and never see a half-built index: each brackets its queries with
+   HostReadLock and HostReadUnlock, which only publish an epoch number.
+
+   An old index is freed once no reader can still be using it (epoch-based
+   reclamation): after the swap, the reloader bumps the global epoch, and
+   waits until every reader is either idle or entered at the new epoch or
+   later. Only the reloader ever waits.
+   */
+
+#define MAX_READERS 64
+
+/* A reader's epoch, alone on its cache line so readers don't share writes.
+   0 means the reader is outside any query. */
+
+typedef struct readerslot {
+  unsigned long epoch;
+  char pad[64 - sizeof(unsigned long)];
+} ReaderSlot;
+
+/* This struct defines a served index. */
+
+typedef struct hostserver {
+  HostDB *current;        /* Swapped atomically; read with HostReadLock. */
+  unsigned long epoch;    /* Starts at 1. */
+  ReaderSlot readers[MAX_READERS];
+  int nreaders;
+
+  char *file;
+  char *dir;              /* The directory being watched, and the file's name in it. */
+  char *base;
+  int nthreads;
+  int inotify_fd;
+  pthread_t tid;
+} HostServer;
+
+HostServer *StartHostServer(char *file, int nthreads);
+int HostReaderRegister(HostServer *srv);
+HostDB *HostReadLock(HostServer *srv, int reader);
+void HostReadUnlock(HostServer *srv, int reader);
+
+#endif // HOSTSERVE_H_
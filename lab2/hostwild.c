@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hostdb.h"
+
+/* hostwild.c
+   Riley Crockett
+
+   This answers wildcard lookups like "*.cs.utk.edu" or "hydra*". HostDBBuildWild
+   sorts the names twice: once as they are, and once compared from the last
+   byte back, as if each name were reversed. A pattern with one '*' then
+   becomes a range of one of those arrays: the names starting with the text
+   before the '*' are a run of the first, and the names ending with the text
+   after it are a run of the second. When the '*' is in the middle, the
+   narrower run is scanned and the rest of the pattern is checked on each name.
+   */
+
+/* @name: CompareNames
+   @brief: The qsort comparator for names in byte order.
+   @param[in] a, b: Pointers to HostName pointers.
+   @return: Returns <0, 0 or >0. */
+
+int CompareNames(const void *a, const void *b) {
+  const HostName *x = *(HostName * const *) a;
+  const HostName *y = *(HostName * const *) b;
+  int c;
+
+  c = memcmp(x->s, y->s, (x->len < y->len) ? x->len : y->len);
+  if (c != 0) return c;
+  return x->len - y->len;
+}
+
+/* @name: CompareReversed
+   @brief: Compares the end of a name with a suffix, from the last byte back.
+   @param[in] s, len: The name.
+   @param[in] t, tlen: The suffix.
+   @param[in] trunc: If set, only the last tlen bytes of the name count, so
+                     a name ending in the suffix compares equal to it.
+   @return: Returns <0, 0 or >0. */
+
+int CompareReversed(const char *s, int len, const char *t, int tlen, int trunc) {
+  int i;
+
+  for (i = 1; i <= len && i <= tlen; i++) {
+    if (s[len-i] != t[tlen-i]) return (unsigned char) s[len-i] - (unsigned char) t[tlen-i];
+  }
+  if (trunc && len >= tlen) return 0;
+  return len - tlen;
+}
+
+/* @name: CompareNamesReversed
+   @brief: The qsort comparator for names compared from the last byte back.
+   @param[in] a, b: Pointers to HostName pointers.
+   @return: Returns <0, 0 or >0. */
+
+int CompareNamesReversed(const void *a, const void *b) {
+  const HostName *x = *(HostName * const *) a;
+  const HostName *y = *(HostName * const *) b;
+
+  return CompareReversed(x->s, x->len, y->s, y->len, 0);
+}
+
+/* @name: CompareIPIds
+   @brief: The qsort comparator for IPs in the order they were read.
+   @param[in] a, b: Pointers to IP pointers.
+   @return: Returns <0, 0 or >0. */
+
+int CompareIPIds(const void *a, const void *b) {
+  return (*(IP * const *) a)->id - (*(IP * const *) b)->id;
+}
+
+/* @name: HostDBBuildWild
+   @brief: Sorts the index's names forwards and backwards for HostDBFindWild.
+   @param[in] db: The index, after its names are built. */
+
+void HostDBBuildWild(HostDB *db) {
+  int k;
+
+  db->sorted = malloc(sizeof(HostName *)*(db->nkeys+1));
+  db->rsorted = malloc(sizeof(HostName *)*(db->nkeys+1));
+  for (k = 0; k < db->nkeys; k++) db->sorted[k] = db->rsorted[k] = &db->keys[k];
+  qsort(db->sorted, db->nkeys, sizeof(HostName *), CompareNames);
+  qsort(db->rsorted, db->nkeys, sizeof(HostName *), CompareNamesReversed);
+}
+
+/* @name: PrefixRange
+   @brief: Finds the run of db->sorted that starts with a prefix.
+   @param[in] db: The index.
+   @param[in] p, plen: The prefix.
+   @param[out] lo, hi: Set to the run, sorted[lo] up to sorted[hi]. */
+
+void PrefixRange(HostDB *db, const char *p, int plen, int *lo, int *hi) {
+  int l, h, m, c, side;
+  HostName *x;
+
+  /* Side 0 finds the first name >= the prefix, side 1 the first one past
+     every name that starts with it. */
+
+  for (side = 0; side < 2; side++) {
+    l = 0;
+    h = db->nkeys;
+    while (l < h) {
+      m = l + (h - l) / 2;
+      x = db->sorted[m];
+      c = memcmp(x->s, p, (x->len < plen) ? x->len : plen);
+      if (c == 0 && x->len < plen) c = -1;
+      if (c < 0 || (side == 1 && c == 0)) l = m + 1; else h = m;
+    }
+    if (side == 0) *lo = l; else *hi = l;
+  }
+}
+
+/* @name: SuffixRange
+   @brief: Finds the run of db->rsorted that ends with a suffix.
+   @param[in] db: The index.
+   @param[in] t, tlen: The suffix.
+   @param[out] lo, hi: Set to the run, rsorted[lo] up to rsorted[hi]. */
+
+void SuffixRange(HostDB *db, const char *t, int tlen, int *lo, int *hi) {
+  int l, h, m, c, side;
+  HostName *x;
+
+  for (side = 0; side < 2; side++) {
+    l = 0;
+    h = db->nkeys;
+    while (l < h) {
+      m = l + (h - l) / 2;
+      x = db->rsorted[m];
+      c = CompareReversed(x->s, x->len, t, tlen, 1);
+      if (c < 0 || (side == 1 && c == 0)) l = m + 1; else h = m;
+    }
+    if (side == 0) *lo = l; else *hi = l;
+  }
+}
+
+/* @name: HostDBFindWild
+   @brief: Looks up every IP with a name matching a pattern with one '*',
+           which matches any run of bytes (even an empty one).
+   @param[in] db: The index, after HostDBBuild.
+   @param[in] pat: The pattern.
+   @param[out] n: Set to the number of IPs.
+   @return: Returns a new array of the IPs, each once, in the order they
+            were read, or NULL if there are none or the pattern does not have
+            exactly one '*'. */
+
+IP **HostDBFindWild(HostDB *db, const char *pat, int *n) {
+  const char *star, *suf;
+  HostName **run, *x;
+  IP **ips;
+  int plen, slen, lo, hi, slo, shi, i, k, j, nips;
+
+  *n = 0;
+  star = strchr(pat, '*');
+  if (star == NULL || strchr(star+1, '*') != NULL) return NULL;
+  plen = star - pat;
+  suf = star + 1;
+  slen = strlen(suf);
+
+  PrefixRange(db, pat, plen, &lo, &hi);
+  SuffixRange(db, suf, slen, &slo, &shi);
+  run = db->sorted;
+  if (shi - slo < hi - lo) {
+    run = db->rsorted;
+    lo = slo;
+    hi = shi;
+  }
+
+  /* Gather each matching name's IPs. The '*' cannot overlap both halves,
+     so a name must be at least as long as the two of them. */
+
+  nips = 0;
+  for (i = lo; i < hi; i++) {
+    x = run[i];
+    if (x->len < plen + slen) continue;
+    if (memcmp(x->s, pat, plen) != 0 || memcmp(x->s + x->len - slen, suf, slen) != 0) continue;
+    k = x - db->keys;
+    nips += db->ip_start[k+1] - db->ip_start[k];
+  }
+  if (nips == 0) return NULL;
+
+  ips = malloc(sizeof(IP *)*nips);
+  nips = 0;
+  for (i = lo; i < hi; i++) {
+    x = run[i];
+    if (x->len < plen + slen) continue;
+    if (memcmp(x->s, pat, plen) != 0 || memcmp(x->s + x->len - slen, suf, slen) != 0) continue;
+    k = x - db->keys;
+    for (j = db->ip_start[k]; j < db->ip_start[k+1]; j++) ips[nips++] = db->ips[j];
+  }
+
+  /* A host's full and short names can both match, so drop the repeats. */
+
+  qsort(ips, nips, sizeof(IP *), CompareIPIds);
+  *n = 0;
+  for (i = 0; i < nips; i++) {
+    if (*n == 0 || ips[*n-1] != ips[i]) ips[(*n)++] = ips[i];
+  }
+  return ips;
+}
@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include "hostdb.h"
+
+/* l2p4.c
+   Riley Crockett
+
+   This program reads host information from the 'converted' file
+   by mapping all of it into memory. There is no cap on the file's size, and
+   nothing is copied: every name is a span into the mapping, whose names are
+   already NUL-separated. The file is loaded by one thread per core, each
+   building an index of its own range, and the ranges are merged (see
+   MapConverted in hostdb.c).
+   */
+
+int main()
+{
+  HostDB *machs;
+
+  machs = NewHostDB();
+  if (MapConverted(machs, "converted", sysconf(_SC_NPROCESSORS_ONLN)) == -1) return -1;
+
+  /* The names point into the mapping, so it stays mapped. */
+  HostDBBuild(machs);
+  printf("Hosts all read in\n\n");
+  printf("Enter host name: ");
+  PrintHosts(machs);
+}
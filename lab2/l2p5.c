@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "hostidx.h"
+
+/* l2p5.c
+   Riley Crockett
+
+   This program answers host lookups from 'converted.idx', the index that
+   mkhostidx compiles from the 'converted' file. The index is only mapped:
+   nothing is read or hashed before the first query, so startup takes the
+   same time no matter how big the database is.
+
+   The index only holds names, so it answers exact name lookups only. Address,
+   CIDR and wildcard queries, which l2p4 answers from the address trie and the
+   sorted name arrays, get "not supported by the index" rather than "no key",
+   since those structures are built at load time and are not in the index.
+   */
+
+int main()
+{
+  HostIdx *idx;
+
+  idx = LoadHostIdx("converted.idx");
+  if (idx == NULL) return -1;
+
+  printf("Hosts all read in\n\n");
+  printf("Enter host name: ");
+  PrintIndexedHosts(idx);
+}
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "hostserve.h"
+
+/* l2p6.c
+   Riley Crockett
+
+   This program answers host lookups like l2p4, but it keeps serving while
+   the 'converted' file is regenerated: when the file is written or
+   replaced, a new index is built in the background and swapped in between
+   queries (see hostserve.h). Each query is answered entirely from one
+   index, old or new.
+
+   Usage: l2p6 [converted]
+   */
+
+int main(int argc, char **argv)
+{
+  HostServer *srv;
+  HostDB *machs;
+  char host_buf[1000];
+  int reader;
+
+  srv = StartHostServer((argc > 1) ? argv[1] : "converted", sysconf(_SC_NPROCESSORS_ONLN));
+  if (srv == NULL) return -1;
+  reader = HostReaderRegister(srv);
+
+  printf("Hosts all read in\n\n");
+  printf("Enter host name: ");
+  fflush(stdout);
+  while (fscanf(stdin, "%999s", host_buf) != EOF) {
+    machs = HostReadLock(srv, reader);
+    PrintQuery(machs, host_buf);
+    HostReadUnlock(srv, reader);
+	printf("\nEnter host name: ");
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "hostdb.h"
+#include "hostidx.h"
+
+/* mkhostidx.c
+   Riley Crockett
+
+   This compiles the 'converted' file into the host index 'converted.idx'
+   (see hostidx.h), which l2p5 maps instead of reading 'converted'. Run it
+   again whenever 'converted' changes.
+
+   Usage: mkhostidx [converted [index]]
+   */
+
+int main(int argc, char **argv)
+{
+  HostDB *machs;
+  char *in, *out;
+
+  in = (argc > 1) ? argv[1] : "converted";
+  out = (argc > 2) ? argv[2] : "converted.idx";
+
+  machs = NewHostDB();
+  if (MapConverted(machs, in, sysconf(_SC_NPROCESSORS_ONLN)) == -1) return -1;
+  HostDBBuild(machs);
+  WriteHostIdx(machs, out);
+  printf("%d names, %d IPs written to %s\n", machs->nkeys, machs->nips, out);
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hostdb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAMETOK_X86 1
+#endif
+
+/* nametok.c
+   Riley Crockett
+
+   This splits a run of NUL-terminated host names into (name, length, first
+   dot) triples, 32 bytes at a time. For each block, one pass builds a bitmask
+   of its NULs and one of its dots (with AVX2 if the CPU has it, otherwise
+   SSE2, otherwise plain C), and names are then read off the masks with
+   count-trailing-zeros instead of byte by byte. Bytes past the last whole
+   block go through the plain C masks, so nothing past end is ever read.
+   */
+
+#define BLOCK 32
+
+/* Builds the NUL and dot masks of one block: bit k is set if byte k matches. */
+
+typedef void (*MaskFunc)(const char *p, unsigned int *nul, unsigned int *dot);
+
+/* @name: ScalarMasks
+   @brief: Builds the masks of up to one block a byte at a time.
+   @param[in] p: The block.
+   @param[in] n: The number of bytes in it (at most BLOCK).
+   @param[out] nul, dot: Set to the masks. */
+
+void ScalarMasks(const char *p, int n, unsigned int *nul, unsigned int *dot) {
+  int k;
+
+  *nul = 0;
+  *dot = 0;
+  for (k = 0; k < n; k++) {
+    if (p[k] == '\0') *nul |= 1u << k;
+    if (p[k] == '.') *dot |= 1u << k;
+  }
+}
+
+/* @name: BlockMasksC
+   @brief: Builds the masks of a whole block in plain C.
+   @param[in] p: The block.
+   @param[out] nul, dot: Set to the masks. */
+
+void BlockMasksC(const char *p, unsigned int *nul, unsigned int *dot) {
+  ScalarMasks(p, BLOCK, nul, dot);
+}
+
+#ifdef NAMETOK_X86
+
+/* @name: BlockMasksSSE2
+   @brief: Builds the masks of a whole block with two 16-byte SSE2 compares.
+   @param[in] p: The block.
+   @param[out] nul, dot: Set to the masks. */
+
+__attribute__((target("sse2")))
+void BlockMasksSSE2(const char *p, unsigned int *nul, unsigned int *dot) {
+  __m128i lo, hi, zero, dots;
+
+  lo = _mm_loadu_si128((const __m128i *) p);
+  hi = _mm_loadu_si128((const __m128i *) (p + 16));
+  zero = _mm_setzero_si128();
+  dots = _mm_set1_epi8('.');
+  *nul = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, zero))
+       | ((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, zero)) << 16);
+  *dot = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, dots))
+       | ((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, dots)) << 16);
+}
+
+/* @name: BlockMasksAVX2
+   @brief: Builds the masks of a whole block with one 32-byte AVX2 compare each.
+   @param[in] p: The block.
+   @param[out] nul, dot: Set to the masks. */
+
+__attribute__((target("avx2")))
+void BlockMasksAVX2(const char *p, unsigned int *nul, unsigned int *dot) {
+  __m256i v;
+
+  v = _mm256_loadu_si256((const __m256i *) p);
+  *nul = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+  *dot = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+}
+
+#endif
+
+/* @name: PickMasks
+   @brief: Picks the fastest mask builder this CPU can run.
+   @return: Returns it. */
+
+MaskFunc PickMasks() {
+#ifdef NAMETOK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return BlockMasksAVX2;
+  if (__builtin_cpu_supports("sse2")) return BlockMasksSSE2;
+#endif
+  return BlockMasksC;
+}
+
+/* The mask builder, picked on the first call to ScanNames. */
+MaskFunc BlockMasks = NULL;
+
+/* @name: ScanNames
+   @brief: Splits up to max NUL-terminated names off the front of a buffer.
+   @param[in] s: The first name.
+   @param[in] end: The end of the buffer.
+   @param[in] max: The most names to split off.
+   @param[out] toks: Filled with each name's start, length, and the offset of
+                     its first '.' (or -1 if it has none).
+   @param[out] next: Set to just past the last name's NUL, or s if there were none.
+   @return: Returns the number of names. If this is less than max, the buffer
+            ran out before the next name's NUL. */
+
+int ScanNames(const char *s, const char *end, int max, NameTok *toks, const char **next) {
+  const char *base, *start;
+  unsigned int nul, dot, below;
+  int n, k, dot_off;
+
+  if (BlockMasks == NULL) BlockMasks = PickMasks();
+
+  n = 0;
+  start = s;
+  dot_off = -1;
+  for (base = s; base < end && n < max; base += BLOCK) {
+    if (end - base >= BLOCK) {
+      BlockMasks(base, &nul, &dot);
+    } else {
+      ScalarMasks(base, end - base, &nul, &dot);
+    }
+
+    /* Each NUL ends a name. Dots at or below it are cleared once it is
+       emitted, so the lowest dot left always belongs to the current name. */
+
+    while (nul != 0 && n < max) {
+      k = __builtin_ctz(nul);
+      below = (k == 31) ? ~0u : (1u << (k + 1)) - 1;
+      if (dot_off < 0 && (dot & below) != 0) dot_off = base + __builtin_ctz(dot) - start;
+
+      toks[n].s = start;
+      toks[n].len = base + k - start;
+      toks[n].dot = dot_off;
+      n++;
+
+      start = base + k + 1;
+      dot_off = -1;
+      nul &= nul - 1;
+      dot &= ~below;
+    }
+    if (dot_off < 0 && dot != 0 && n < max) dot_off = base + __builtin_ctz(dot) - start;
+  }
+  *next = (n > 0) ? toks[n-1].s + toks[n-1].len + 1 : s;
+  return n;
+}
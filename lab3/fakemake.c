@@ -3,9 +3,14 @@
 #include <string.h>
 #include "dllist.h"
 #include "fields.h"
+#include "jrb.h"
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
 #include <fcntl.h>
+#include <dirent.h>
 
 /* fakemake.c
    Riley Crockett
@@ -13,7 +18,20 @@
 
    This program helps automate the compiling of a single executable.
    It reads file information from a .fm file, and compiles the necessary
-   files for the executable.
+   files for the executable. With -j N, up to N files are compiled at once.
+
+   What each .o file and the executable were built from is kept as content
+   hashes in a build database next to the .fm file (see LoadDB), so touching
+   a file, or checking it out again unchanged, doesn't remake anything, and
+   changing the F line does. The hash of what was built is kept too, so an
+   object the database didn't build, or one built over since (by another
+   fmakefile sharing the .c file, say), is remade.
+
+   If FAKEMAKE_CACHE names a directory, compiled objects are also kept
+   there, keyed by their preprocessed source, the compiler and the flags,
+   and an object already in it is linked into place instead of compiled
+   again (see CachedCompile). FAKEMAKE_CACHE_MB bounds its size (default 1024); the
+   least recently used objects go first.
    */
 
 /* @name: ListStore
@@ -27,21 +45,326 @@ void ListStore(Dllist *l, IS is) {
   }
 }
 
+/* This struct defines a record in the build database: a file's content
+   hash and the (size, mtime, inode) it had when hashed, or the key an
+   object or the executable was last built from and the content hash of
+   what was built. live marks the records used this run; only those are
+   saved. */
+
+typedef struct rec {
+  long size;
+  long mtime;
+  long ino;
+  unsigned long hash;
+  unsigned long out;
+  int live;
+} Rec;
+
+/* This struct defines the build database, kept in <fmakefile>.fmdb. */
+
+typedef struct builddb {
+  char *path;
+  JRB files;            /* File name -> Rec, with the file's hash. */
+  JRB keys;             /* Object or executable name -> Rec, with its key. */
+  unsigned long flags;  /* The hash of the F line. */
+  Dllist h;             /* The H line, for objects with no .d file. */
+  char *cache;          /* The object cache directory, or NULL for none. */
+  long cache_max;       /* The most bytes the cache may hold. */
+  unsigned long compiler; /* The hash of the compiler (see CompilerKey). */
+} BuildDB;
+
+/* @name: HashBytes
+   @brief: This adds bytes to an FNV-1a hash.
+   @param[in] h: The hash so far.
+   @param[in] p: The bytes.
+   @param[in] n: The number of bytes.
+   @param[out]: Returns the new hash. */
+
+unsigned long HashBytes(unsigned long h, const void *p, size_t n) {
+  const unsigned char *b = p;
+
+  for (size_t i = 0; i < n; i++) { h = (h ^ b[i]) * 1099511628211UL; }
+  return h;
+}
+
+/* @name: FindRec
+   @brief: This finds a record, making an empty one if there is none.
+   @param[in] t: The files or keys tree.
+   @param[in] name: The file, object or executable name.
+   @param[out]: Returns the record. */
+
+Rec *FindRec(JRB t, char *name) {
+  JRB n;
+  Rec *r;
+
+  n = jrb_find_str(t, name);
+  if (n != NULL) { return (Rec *) n->val.v; }
+  r = calloc(1, sizeof(Rec));
+  r->ino = -1;
+  jrb_insert_str(t, strdup(name), new_jval_v(r));
+  return r;
+}
+
+/* @name: HashFile
+   @brief: This gets a file's content hash. If the file's size, mtime and
+           inode are what they were when it was last hashed, the old hash
+           is trusted; otherwise the file is read and hashed again.
+   @param[in] db: The build database.
+   @param[in] name: The file's name.
+   @param[out] hash: The hash.
+   @param[out]: Returns 0, or -1 if the file can't be read. */
+
+int HashFile(BuildDB *db, char *name, unsigned long *hash) {
+  struct stat buf;
+  Rec *r;
+  char block[65536];
+  unsigned long h;
+  long mtime;
+  ssize_t n;
+  int fd;
+
+  if (stat(name, &buf) < 0) { return -1; }
+  mtime = buf.st_mtim.tv_sec * 1000000000L + buf.st_mtim.tv_nsec;
+  r = FindRec(db->files, name);
+  r->live = 1;
+  if (r->size == buf.st_size && r->mtime == mtime && r->ino == (long) buf.st_ino) {
+    *hash = r->hash;
+    return 0;
+  }
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0) { return -1; }
+  h = 14695981039346656037UL;
+  while ((n = read(fd, block, sizeof(block))) > 0) { h = HashBytes(h, block, n); }
+  close(fd);
+  if (n < 0) { return -1; }
+
+  r->size = buf.st_size;
+  r->mtime = mtime;
+  r->ino = buf.st_ino;
+  r->hash = h;
+  *hash = h;
+  return 0;
+}
+
+/* @name: LoadDB
+   @brief: This reads the build database for a description file. Its lines
+           are "F name size mtime inode hash" and "K name key hash". A missing
+           or unreadable database is just empty.
+   @param[in] fname: The description file's name.
+   @param[in] f: A dllist with compile flags.
+   @param[in] h: A dllist with header files.
+   @param[out]: Returns the database. */
+
+BuildDB *LoadDB(char *fname, Dllist f, Dllist h) {
+  BuildDB *db;
+  Dllist dt;
+  Rec *r;
+  IS is;
+
+  db = calloc(1, sizeof(BuildDB));
+  db->path = malloc(strlen(fname) + 6);
+  sprintf(db->path, "%s.fmdb", fname);
+  db->files = make_jrb();
+  db->keys = make_jrb();
+  db->h = h;
+  db->flags = 14695981039346656037UL;
+  dll_traverse(dt, f) { db->flags = HashBytes(db->flags, dt->val.s, strlen(dt->val.s) + 1); }
+
+  is = new_inputstruct(db->path);
+  if (is == NULL) { return db; }
+  while (get_line(is) >= 0) {
+    if (is->NF == 6 && !strcmp(is->fields[0], "F")) {
+      r = FindRec(db->files, is->fields[1]);
+      r->size = atol(is->fields[2]);
+      r->mtime = atol(is->fields[3]);
+      r->ino = atol(is->fields[4]);
+      r->hash = strtoul(is->fields[5], NULL, 16);
+    } else if (is->NF == 4 && !strcmp(is->fields[0], "K")) {
+      r = FindRec(db->keys, is->fields[1]);
+      r->hash = strtoul(is->fields[2], NULL, 16);
+      r->out = strtoul(is->fields[3], NULL, 16);
+    }
+  }
+  jettison_inputstruct(is);
+  return db;
+}
+
+/* @name: SaveDB
+   @brief: This writes the records used this run back to the build
+           database, through a temporary file so it is never half written.
+   @param[in] db: The build database. */
+
+void SaveDB(BuildDB *db) {
+  JRB n;
+  Rec *r;
+  FILE *fp;
+  char *tmp;
+
+  tmp = malloc(strlen(db->path) + 5);
+  sprintf(tmp, "%s.tmp", db->path);
+  fp = fopen(tmp, "w");
+  if (fp == NULL) {
+    perror(tmp);
+    free(tmp);
+    return;
+  }
+  jrb_traverse(n, db->files) {
+    r = (Rec *) n->val.v;
+    if (r->live) { fprintf(fp, "F %s %ld %ld %ld %016lx\n", n->key.s, r->size, r->mtime, r->ino, r->hash); }
+  }
+  jrb_traverse(n, db->keys) {
+    r = (Rec *) n->val.v;
+    if (r->live) { fprintf(fp, "K %s %016lx %016lx\n", n->key.s, r->hash, r->out); }
+  }
+  if (fclose(fp) != 0 || rename(tmp, db->path) < 0) { perror(db->path); }
+  free(tmp);
+}
+
+/* @name: ObjectKey
+   @brief: This makes the key a .o file is built from: the flags, plus the
+           name and hash of the .c file and of every header in its .d file.
+           With no .d file, every H header is used instead.
+   @param[in] db: The build database.
+   @param[in] c_name: The name of the .c file.
+   @param[out] key: The key.
+   @param[out]: Returns 0, or -1 if one of the files can't be read. */
+
+int ObjectKey(BuildDB *db, char *c_name, unsigned long *key) {
+  unsigned long k, h;
+  char *d_name, *dep;
+  Dllist dt;
+  IS is;
+  int i;
+
+  k = db->flags;
+  d_name = strdup(c_name); d_name[strlen(c_name)-1] = 'd';
+  is = new_inputstruct(d_name);
+  free(d_name);
+
+  if (is == NULL) {
+    if (HashFile(db, c_name, &h) < 0) { return -1; }
+    k = HashBytes(HashBytes(k, c_name, strlen(c_name) + 1), &h, sizeof(h));
+    dll_traverse(dt, db->h) {
+      if (HashFile(db, dt->val.s, &h) < 0) { return -1; }
+      k = HashBytes(HashBytes(k, dt->val.s, strlen(dt->val.s) + 1), &h, sizeof(h));
+    }
+  } else {
+    while (get_line(is) >= 0) {
+      for (i = 0; i < is->NF; i++) {
+        dep = is->fields[i];
+        if (!strcmp(dep, "\\") || dep[strlen(dep)-1] == ':') { continue; }
+        if (HashFile(db, dep, &h) < 0) {
+          jettison_inputstruct(is);
+          return -1;
+        }
+        k = HashBytes(HashBytes(k, dep, strlen(dep) + 1), &h, sizeof(h));
+      }
+    }
+    jettison_inputstruct(is);
+  }
+  *key = k;
+  return 0;
+}
+
+/* @name: ExecKey
+   @brief: This makes the key the executable is linked from: the flags, the
+           libraries, and the name and hash of every .o file.
+   @param[in] db: The build database.
+   @param[in] c: A dllist with .c files.
+   @param[in] l: A dllist with libraries.
+   @param[out] key: The key.
+   @param[out]: Returns 0, or -1 if a .o file can't be read. */
+
+int ExecKey(BuildDB *db, Dllist c, Dllist l, unsigned long *key) {
+  unsigned long k, h;
+  char *obj;
+  Dllist dt;
+
+  k = db->flags;
+  dll_traverse(dt, l) { k = HashBytes(k, dt->val.s, strlen(dt->val.s) + 1); }
+  dll_traverse(dt, c) {
+    obj = strdup(dt->val.s); obj[strlen(obj)-1] = 'o';
+    if (HashFile(db, obj, &h) < 0) {
+      free(obj);
+      return -1;
+    }
+    k = HashBytes(HashBytes(k, obj, strlen(obj) + 1), &h, sizeof(h));
+    free(obj);
+  }
+  *key = k;
+  return 0;
+}
+
+/* @name: SetKey
+   @brief: This records the key an object or the executable was just built
+           from, and the content hash of what was built.
+   @param[in] db: The build database.
+   @param[in] name: The object or executable.
+   @param[in] key: The key. */
+
+void SetKey(BuildDB *db, char *name, unsigned long key) {
+  Rec *r;
+
+  r = FindRec(db->keys, name);
+  r->hash = key;
+  if (HashFile(db, name, &r->out) < 0) { r->out = 0; }
+  r->live = 1;
+}
+
+/* @name: Rebuilt
+   @brief: This checks whether an object or the executable is still what
+           was built from its key, and not, say, something another
+           fmakefile built over it.
+   @param[in] db: The build database.
+   @param[in] name: The object or executable.
+   @param[in] r: Its record, from FindKey.
+   @param[out]: Returns 1 if it has changed or can't be read, 0 if not. */
+
+int Rebuilt(BuildDB *db, char *name, Rec *r) {
+  unsigned long h;
+
+  return (HashFile(db, name, &h) < 0 || h != r->out);
+}
+
+/* @name: FindKey
+   @brief: This finds the key an object or the executable was last built from.
+   @param[in] db: The build database.
+   @param[in] name: The object or executable.
+   @param[out]: Returns its record (marked live), or NULL if there is none. */
+
+Rec *FindKey(BuildDB *db, char *name) {
+  JRB n;
+
+  n = jrb_find_str(db->keys, name);
+  if (n == NULL) { return NULL; }
+  ((Rec *) n->val.v)->live = 1;
+  return (Rec *) n->val.v;
+}
+
 /* @name: ProcessFiles
    @brief: This traverses a list of header or .c files, flags remakes,
-           and updates the maximum modification time of header and .o files.
+           and updates the maximum modification time of .o files. A .c
+           file is remade if the key its .o file was built from (see
+           ObjectKey) has changed, or the .o file is no longer what was
+           built. A .o file the build database didn't build is always
+           remade: its timestamps can't say what flags it was built with
+           (another fmakefile may share the .c file), so it is never
+           trusted or given a key.
    @param[in] l: A Dllist with header or C file names.
-   @param[in] max_ht: The maximum header modification time. 
    @param[in] max_ot: The maximum .o file modification time. 
    @param[in] rmks: A Dllist for the remakes.
    @param[in] spec: Is 0 for header files, and 1 for C files.
+   @param[in] db: The build database.
    @param[out]: Returns 1 if a C or header file does not exist, 0 otherwise. */
 
-int ProcessFiles(Dllist l, time_t *max_ht, time_t *max_ot, Dllist *rmks, int spec) {
+int ProcessFiles(Dllist l, time_t *max_ot, Dllist *rmks, int spec, BuildDB *db) {
   char *cf, *obj;
   Dllist lt;
   struct stat buf;
-  int exists, ct;
+  int exists, changed;
+  unsigned long key;
+  Rec *r;
 
   dll_traverse(lt, l) {
     exists = stat(lt->val.s, &buf);
@@ -49,103 +372,511 @@ int ProcessFiles(Dllist l, time_t *max_ht, time_t *max_ot, Dllist *rmks, int spe
 	  fprintf(stderr, "fmakefile: %s: No such file or directory\n", lt->val.s);
 	  return 1;
 	} else { 
-	  if (spec == 0) {
-	    if (*max_ht < buf.st_mtime) { *max_ht = buf.st_mtime; }
-	  } else if (spec == 1) {
+	  if (spec == 1) {
 	    cf = strdup(lt->val.s);
 	    obj = strdup(lt->val.s); obj[strlen(lt->val.s)-1] = 'o';
-	    ct = buf.st_mtime;
 	    exists = stat(obj, &buf);
 	    if (exists < 0) {
 		  dll_append(*rmks, new_jval_s(strdup(cf)));
 	    } else {
-	      if (buf.st_mtime < *max_ht || buf.st_mtime < ct) {
+	      r = FindKey(db, obj);
+	      changed = (r == NULL || ObjectKey(db, cf, &key) < 0 || key != r->hash || Rebuilt(db, obj, r));
+	      if (changed) {
 		    dll_append(*rmks, new_jval_s(strdup(cf)));
 	 	  }
 		  if (*max_ot < buf.st_mtime) { *max_ot = buf.st_mtime; }
 	    }
+	    free(cf);
+	    free(obj);
 	  }
 	}
   }
   return 0;
 }
 
-/* @name: RemakeCFile
-   @brief: This creates a string for compiling a .c file.
-   @param[in] dt: A dllist node for traversing.
-   @param[in] f: A dllist with compile flags. 
-   @param[in] c_name: The name of the .c file. 
-   @param[out]: Returns a 1 if an error occured, otherwise returns 0. */
+/* @name: Spawn
+   @brief: This prints a command and starts it, without waiting for it.
+   @param[in] args: The command's words, ending with NULL.
+   @param[out]: Returns the command's process id, or -1 if fork failed. */
 
-int RemakeCFile(Dllist dt, Dllist f, char *c_name) {
-  char rmk_str[100];
-  strcpy(rmk_str, "gcc -c");
-  dll_traverse(dt, f) { strcat(rmk_str, " "); strcat(rmk_str, dt->val.s); }
-  strcat(rmk_str, " "); strcat(rmk_str, c_name);
-  
-  printf("%s\n", rmk_str);
-  int ret = system(rmk_str);
-  
-  if (ret != 0) {
-    if (ret == -1 || ret == 127 || ret == 1) {
-      fprintf(stderr, "Command failed.  Fakemake exiting\n");
-    } else {
-      fprintf(stderr, "Command failed.  Exiting\n");
-	}
-	return 1;
-  } 
+pid_t Spawn(char **args) {
+  pid_t pid;
+  int i;
+
+  for (i = 0; args[i] != NULL; i++) { printf((i == 0) ? "%s" : " %s", args[i]); }
+  printf("\n");
+  fflush(stdout);
+
+  pid = fork();
+  if (pid == 0) {
+    execvp(args[0], args);
+    perror(args[0]);
+    _exit(127);
+  }
+  return pid;
+}
+
+/* @name: Failed
+   @brief: This checks a command's exit status, and prints that it failed.
+           A failed compile and a failed link have always said different
+           things, and still do.
+   @param[in] status: The status from waitpid.
+   @param[in] link: Is 0 for a compile, and 1 for the link.
+   @param[out]: Returns 1 if the command failed, otherwise 0. */
+
+int Failed(int status, int link) {
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) { return 0; }
+  if (link) {
+    fprintf(stderr, "Command failed.  Fakemake exiting\n");
+  } else {
+    fprintf(stderr, "Command failed.  Exiting\n");
+  }
+  return 1;
+}
+
+/* @name: CompileArgs
+   @brief: This makes the words of the command for compiling a .c file.
+           -MMD has gcc write the headers the file includes to a .d file,
+           for ObjectKey.
+   @param[in] f: A dllist with compile flags.
+   @param[in] c_name: The name of the .c file.
+   @param[out]: Returns the words, ending with NULL. */
+
+char **CompileArgs(Dllist f, char *c_name) {
+  Dllist dt;
+  char **args;
+  int n;
+
+  n = 0;
+  dll_traverse(dt, f) { n++; }
+  args = malloc(sizeof(char *)*(n+5));
+  n = 0;
+  args[n++] = "gcc";
+  args[n++] = "-c";
+  args[n++] = "-MMD";
+  dll_traverse(dt, f) { args[n++] = dt->val.s; }
+  args[n++] = c_name;
+  args[n] = NULL;
+  return args;
+}
+
+/* @name: HashCommand
+   @brief: This runs a command and adds what it writes to standard output
+           to a hash. Its standard error is thrown away.
+   @param[in] args: The command's words, ending with NULL.
+   @param[in] k: The hash so far.
+   @param[out] key: The new hash.
+   @param[out]: Returns 0, or -1 if the command couldn't be run or failed. */
+
+int HashCommand(char **args, unsigned long k, unsigned long *key) {
+  char block[65536];
+  ssize_t n;
+  pid_t pid;
+  int p[2], status;
+
+  if (pipe(p) < 0) { return -1; }
+  pid = fork();
+  if (pid == 0) {
+    dup2(p[1], 1);
+    close(p[0]);
+    close(p[1]);
+    close(2);
+    open("/dev/null", O_WRONLY);
+    execvp(args[0], args);
+    _exit(127);
+  }
+  close(p[1]);
+  if (pid < 0) {
+    close(p[0]);
+    return -1;
+  }
+  while ((n = read(p[0], block, sizeof(block))) > 0) { k = HashBytes(k, block, n); }
+  close(p[0]);
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) { return -1; }
+  *key = k;
   return 0;
 }
 
+/* @name: CompilerKey
+   @brief: This hashes which gcc is on the PATH: its version and target, so
+           upgrading or switching compilers doesn't reuse cached objects.
+   @param[out] key: The hash.
+   @param[out]: Returns 0, or -1 if gcc couldn't be run. */
+
+int CompilerKey(unsigned long *key) {
+  char *args[] = { "gcc", "-dumpfullversion", "-dumpmachine", NULL };
+
+  return HashCommand(args, 14695981039346656037UL, key);
+}
+
+/* @name: CacheKey
+   @brief: This makes the key a .c file's object is cached under: the hash
+           of the file after preprocessing, plus the compiler and the flags.
+           With -g, the object records the directory it was built in, so
+           that counts too.
+   @param[in] f: A dllist with compile flags.
+   @param[in] c_name: The name of the .c file.
+   @param[in] compiler: The compiler's hash (see CompilerKey).
+   @param[out] key: The key.
+   @param[out]: Returns 0, or -1 if the file couldn't be preprocessed. */
+
+int CacheKey(Dllist f, char *c_name, unsigned long compiler, unsigned long *key) {
+  Dllist dt;
+  char **args, cwd[4096];
+  unsigned long k;
+  int dbg, ret;
+
+  k = HashBytes(compiler, "gcc -c -MMD", 12);
+  dbg = 0;
+  dll_traverse(dt, f) {
+    k = HashBytes(k, dt->val.s, strlen(dt->val.s) + 1);
+    if (!strncmp(dt->val.s, "-g", 2)) { dbg = 1; }
+  }
+  if (dbg && getcwd(cwd, sizeof(cwd)) != NULL) { k = HashBytes(k, cwd, strlen(cwd) + 1); }
+
+  /* Any error is left for the real compile to report. */
+
+  args = CompileArgs(f, c_name);
+  args[1] = "-E";
+  for (int i = 2; args[i] != NULL; i++) { args[i] = args[i+1]; }
+  ret = HashCommand(args, k, key);
+  free(args);
+  return ret;
+}
+
+/* @name: LinkOrCopy
+   @brief: This hard-links a file to a new name, or copies it if it can't
+           be linked (e.g. it is on another file system).
+   @param[in] from: The file.
+   @param[in] to: The new name, which must not exist.
+   @param[out]: Returns 0, or -1 if the file couldn't be linked or copied. */
+
+int LinkOrCopy(char *from, char *to) {
+  char block[65536];
+  ssize_t n;
+  int in, out;
+
+  if (link(from, to) == 0) { return 0; }
+  in = open(from, O_RDONLY);
+  if (in < 0) { return -1; }
+  out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (out < 0) {
+    close(in);
+    return -1;
+  }
+  while ((n = read(in, block, sizeof(block))) > 0) {
+    if (write(out, block, n) != n) { n = -1; break; }
+  }
+  close(in);
+  if (close(out) < 0 || n < 0) {
+    unlink(to);
+    return -1;
+  }
+  return 0;
+}
+
+/* @name: CachePut
+   @brief: This stores a file in the cache, under a temporary name first so
+           another fakemake never sees it half written.
+   @param[in] from: The file.
+   @param[in] to: Its name in the cache. */
+
+void CachePut(char *from, char *to) {
+  char *tmp;
+
+  tmp = malloc(strlen(to) + 32);
+  sprintf(tmp, "%s.%d.tmp", to, (int) getpid());
+  if (LinkOrCopy(from, tmp) == 0 && rename(tmp, to) < 0) { unlink(tmp); }
+  free(tmp);
+}
+
+/* @name: CachedCompile
+   @brief: This makes a .o file (and its .d file) from the object cache if
+           it has them, or else compiles it and adds the result to the
+           cache. It runs in its own process, one per compile job. Objects
+           in the tree are hard links into the cache where possible, so the
+           old .o and .d files are removed before compiling rather than
+           written over.
+   @param[in] db: The build database, with the cache directory and the
+                  compiler's hash.
+   @param[in] f: A dllist with compile flags.
+   @param[in] c_name: The name of the .c file.
+   @param[out]: Returns the exit status for the job. */
+
+int CachedCompile(BuildDB *db, Dllist f, char *c_name) {
+  char *cache = db->cache;
+  char *obj, *dep, *c_obj, *c_dep, **args;
+  unsigned long key;
+  int keyed, status;
+  pid_t pid;
+
+  obj = strdup(c_name); obj[strlen(obj)-1] = 'o';
+  dep = strdup(c_name); dep[strlen(dep)-1] = 'd';
+  c_obj = malloc(strlen(cache) + 24);
+  c_dep = malloc(strlen(cache) + 24);
+
+  keyed = (CacheKey(f, c_name, db->compiler, &key) == 0);
+  if (keyed) {
+    sprintf(c_obj, "%s/%016lx.o", cache, key);
+    sprintf(c_dep, "%s/%016lx.d", cache, key);
+    if (access(c_obj, R_OK) == 0 && access(c_dep, R_OK) == 0) {
+      unlink(obj);
+      unlink(dep);
+      if (LinkOrCopy(c_obj, obj) == 0 && LinkOrCopy(c_dep, dep) == 0) {
+
+        /* The entry's mtime is when it was last used, for TrimCache. */
+
+        utimes(c_obj, NULL);
+        utimes(c_dep, NULL);
+        utimes(obj, NULL);
+        utimes(dep, NULL);
+        printf("%s from cache\n", obj);
+        return 0;
+      }
+    }
+  }
+
+  unlink(obj);
+  unlink(dep);
+  args = CompileArgs(f, c_name);
+  pid = Spawn(args);
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    perror("fakemake");
+    return 1;
+  }
+  if (!WIFEXITED(status)) { return 1; }
+  if (WEXITSTATUS(status) == 0 && keyed) {
+    CachePut(obj, c_obj);
+    CachePut(dep, c_dep);
+  }
+  return WEXITSTATUS(status);
+}
+
+/* This struct defines a file in the cache, for TrimCache. */
+
+typedef struct centry {
+  char *name;
+  long size;
+  time_t mtime;
+} CEntry;
+
+/* @name: CompareEntries
+   @brief: The qsort comparator for cache files, least recently used first.
+   @param[in] a, b: Pointers to CEntries.
+   @param[out]: Returns <0, 0 or >0. */
+
+int CompareEntries(const void *a, const void *b) {
+  const CEntry *x = a, *y = b;
+
+  return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* @name: TrimCache
+   @brief: This removes the least recently used files from the cache until
+           it holds at most 90% of its limit, if it's over the limit.
+   @param[in] cache: The cache directory.
+   @param[in] max: The most bytes the cache may hold. */
+
+void TrimCache(char *cache, long max) {
+  DIR *d;
+  struct dirent *de;
+  struct stat buf;
+  CEntry *ents;
+  char *path;
+  long total;
+  int n, cap, i;
+
+  d = opendir(cache);
+  if (d == NULL) { return; }
+  ents = NULL;
+  n = cap = 0;
+  total = 0;
+  while ((de = readdir(d)) != NULL) {
+    if (de->d_name[0] == '.') { continue; }
+    path = malloc(strlen(cache) + strlen(de->d_name) + 2);
+    sprintf(path, "%s/%s", cache, de->d_name);
+    if (stat(path, &buf) < 0 || !S_ISREG(buf.st_mode)) {
+      free(path);
+      continue;
+    }
+    if (n == cap) {
+      cap = (cap == 0) ? 256 : cap * 2;
+      ents = realloc(ents, sizeof(CEntry)*cap);
+    }
+    ents[n].name = path;
+    ents[n].size = buf.st_size;
+    ents[n].mtime = buf.st_mtime;
+    total += buf.st_size;
+    n++;
+  }
+  closedir(d);
+
+  if (total > max) {
+    qsort(ents, n, sizeof(CEntry), CompareEntries);
+    for (i = 0; i < n && total > max / 10 * 9; i++) {
+      if (unlink(ents[i].name) == 0) { total -= ents[i].size; }
+    }
+  }
+  for (i = 0; i < n; i++) { free(ents[i].name); }
+  free(ents);
+}
+
+/* @name: RemakeCFiles
+   @brief: This compiles .c files, running up to njobs compiles at once.
+           Once one fails, no more are started, but the ones already
+           running are waited for.
+   @param[in] rmks: A dllist with the .c files to compile.
+   @param[in] f: A dllist with compile flags.
+   @param[in] njobs: The most compiles to run at once.
+   @param[in] db: The build database, where each compiled .o file's key is
+                  recorded. If it has an object cache, each job goes
+                  through CachedCompile.
+   @param[out]: Returns a 1 if an error occured, otherwise returns 0. */
+
+int RemakeCFiles(Dllist rmks, Dllist f, int njobs, BuildDB *db) {
+  Dllist next;
+  char **args, **names, *obj;
+  pid_t pid, *pids;
+  int running, failed, status, i;
+  unsigned long key;
+
+  /* pids[i] is compiling names[i], or is 0 if slot i is free. */
+
+  pids = calloc(njobs, sizeof(pid_t));
+  names = calloc(njobs, sizeof(char *));
+  next = dll_first(rmks);
+  running = 0;
+  failed = 0;
+  while (running > 0 || (!failed && next != dll_nil(rmks))) {
+    while (!failed && running < njobs && next != dll_nil(rmks)) {
+      if (db->cache != NULL) {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) { exit(CachedCompile(db, f, next->val.s)); }
+      } else {
+
+        /* The .o and .d files may be hard links into an object cache from
+           an earlier run, which gcc would write through. */
+
+        obj = strdup(next->val.s); obj[strlen(obj)-1] = 'o';
+        unlink(obj);
+        obj[strlen(obj)-1] = 'd';
+        unlink(obj);
+        free(obj);
+        args = CompileArgs(f, next->val.s);
+        pid = Spawn(args);
+        free(args);
+      }
+      if (pid < 0) {
+        perror("fork");
+        failed = 1;
+        break;
+      }
+      for (i = 0; pids[i] != 0; i++) ;
+      pids[i] = pid;
+      names[i] = next->val.s;
+      running++;
+      next = dll_next(next);
+    }
+    if (running == 0) { break; }
+
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      perror("waitpid");
+      failed = 1;
+      break;
+    }
+    for (i = 0; i < njobs && pids[i] != pid; i++) ;
+    if (i == njobs) { continue; }
+    pids[i] = 0;
+    running--;
+    if (Failed(status, 0)) {
+      failed = 1;
+    } else if (ObjectKey(db, names[i], &key) == 0) {
+      obj = strdup(names[i]); obj[strlen(obj)-1] = 'o';
+      SetKey(db, obj, key);
+      free(obj);
+    }
+  }
+  free(pids);
+  free(names);
+  return failed;
+}
+
 /* @name: CheckExec
    @brief: This checks the conditions for an executable to be made.
    @param[in] e: The name of the executable.
    @param[in] max_otime: The maximum modification time of the .o files.
    @param[in] cmod: Is 0 if no .c files were remade, or 1 if any were remade.
-   @param[out]: Returns 1 if the executable needs to be remade, otherwise 0. */
+   @param[in] db: The build database.
+   @param[in] c: A dllist with .c files.
+   @param[in] l: A dllist with libraries.
+   @param[out]: Returns 1 if the executable needs to be remade, otherwise 0.
+                If the build database linked the executable, it is remade
+                only if its key (see ExecKey) has changed or it is no longer
+                what was linked, so recompiling a .o file to the same bytes
+                doesn't relink it. */
 
-int CheckExec(char *e, time_t max_otime, int cmod) {
+int CheckExec(char *e, time_t max_otime, int cmod, BuildDB *db, Dllist c, Dllist l) {
   int exists;
   struct stat buf;
+  unsigned long key;
+  Rec *r;
   
   exists = stat(e, &buf);
   if (exists < 0) { return 1; }
+  if (ExecKey(db, c, l, &key) < 0) { return 1; }
+  r = FindKey(db, e);
+  if (r != NULL) { return (key != r->hash || Rebuilt(db, e, r)); }
   if (cmod == 1) { return 1; }
   if (buf.st_mtime < max_otime) { return 1; }
   return 0;
 }
 
 /* @name: RemakeExec
-   @brief: This creates a string for creating an executable.
+   @brief: This links the executable from the .o files.
    @param[in] ex: The executable name.
-   @param[in] dt: A dllist node for traversing.
    @param[in] f: A dllist with compile flags.
    @param[in] l: A dllist with libraries.
    @param[in] c: A dllist with .c files.
    @param[out]: Returns a 1 if an error occured, otherwise returns 0. */
 
-int RemakeExec(char *ex, Dllist dt, Dllist f, Dllist l, Dllist c) {
-  char rmk_str[100];
-  strcpy(rmk_str, "gcc -o "); strcat(rmk_str, ex);
-  dll_traverse(dt, f) { strcat(rmk_str, " "); strcat(rmk_str, dt->val.s); }
+int RemakeExec(char *ex, Dllist f, Dllist l, Dllist c) {
+  Dllist dt;
+  char **args, *obj;
+  pid_t pid;
+  int n, nc, i, status;
+
+  n = 0;
+  nc = 0;
+  dll_traverse(dt, f) { n++; }
+  dll_traverse(dt, c) { nc++; }
+  dll_traverse(dt, l) { n++; }
+  args = malloc(sizeof(char *)*(n+nc+4));
+  n = 0;
+  args[n++] = "gcc";
+  args[n++] = "-o";
+  args[n++] = ex;
+  dll_traverse(dt, f) { args[n++] = dt->val.s; }
+  i = n;
   dll_traverse(dt, c) {
-	strcat(rmk_str, " "); 
-	strncat(rmk_str, dt->val.s, strlen(dt->val.s)-1);
-	strcat(rmk_str, "o");
+    obj = strdup(dt->val.s); obj[strlen(obj)-1] = 'o';
+    args[n++] = obj;
   }
-  dll_traverse(dt, l) { strcat(rmk_str, " "); strcat(rmk_str, dt->val.s); }
+  dll_traverse(dt, l) { args[n++] = dt->val.s; }
+  args[n] = NULL;
 
-  printf("%s\n", rmk_str);
-  int ret = system(rmk_str);
-  
-  if (ret != 0) {
-    if (ret == -1 || ret == 1) { 
-	  fprintf(stderr, "Command failed.  Exiting\n");
-	} else {
-	  fprintf(stderr, "Command failed.  Fakemake exiting\n");
-    }
-	return 1;
+  pid = Spawn(args);
+  status = 0;
+  if (pid < 0) {
+    perror("fork");
+  } else {
+    waitpid(pid, &status, 0);
   }
+  for (n = 0; n < nc; n++) { free(args[i+n]); }
+  free(args);
+
+  if (pid < 0 || Failed(status, 1)) { return 1; }
   return 0;
 }
 
@@ -163,18 +894,24 @@ void FreeLists(Dllist *c, Dllist *h, Dllist *f, Dllist *l, Dllist *rmks) {
 }
 
 int main(int argc, char *argv[]) {
-  char *fname;
+  char *fname = NULL;
   IS is;
+  int njobs = 1;
 
   /* Check fakemake's usage, and if the fm file exists. */
 
-  if (argc == 1) { fname = strdup("fmakefile"); }
-  if (argc == 2) { fname = strdup(argv[1]); }
-  if (argc >= 3) {
-    fprintf(stderr, "usage: fakemake [ description - file ]\n");
-	free(fname);
-	return -1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j") && i+1 < argc && atoi(argv[i+1]) > 0) {
+      njobs = atoi(argv[++i]);
+    } else if (fname == NULL && argv[i][0] != '-') {
+      fname = strdup(argv[i]);
+    } else {
+      fprintf(stderr, "usage: fakemake [ -j jobs ] [ description - file ]\n");
+      free(fname);
+      return -1;
+    }
   }
+  if (fname == NULL) { fname = strdup("fmakefile"); }
   is = new_inputstruct(fname);
   if (is == NULL) {
     fprintf(stderr, "fakemake: %s: No such file or directory\n", fname);
@@ -185,10 +922,12 @@ int main(int argc, char *argv[]) {
 
   char *e = '\0';
   Dllist c = new_dllist(), h = new_dllist(), f = new_dllist(), l = new_dllist();
-  Dllist dt;
   Dllist c_remakes = new_dllist();
-  time_t max_htime = 0, max_otime = 0;
+  time_t max_otime = 0;
   int cmod = 0;
+  int failed;
+  BuildDB *db;
+  unsigned long key;
 
   /* Traverse the .fm file and store files in dllists. */
   
@@ -218,31 +957,48 @@ int main(int argc, char *argv[]) {
 
   /* Check if the header and C files exist and flag remakes. */
 
-  if (ProcessFiles(h, &max_htime, &max_otime, &c_remakes, 0)) { 
+  db = LoadDB(fname, f, h);
+  db->cache = getenv("FAKEMAKE_CACHE");
+  if (db->cache != NULL && db->cache[0] == '\0') { db->cache = NULL; }
+  if (db->cache != NULL && CompilerKey(&db->compiler) < 0) { db->cache = NULL; }
+  if (db->cache != NULL) {
+    mkdir(db->cache, 0755);
+    db->cache_max = 1024;
+    if (getenv("FAKEMAKE_CACHE_MB") != NULL && atol(getenv("FAKEMAKE_CACHE_MB")) > 0) {
+      db->cache_max = atol(getenv("FAKEMAKE_CACHE_MB"));
+    }
+    db->cache_max *= 1024 * 1024;
+  }
+  if (ProcessFiles(h, &max_otime, &c_remakes, 0, db)) { 
 	FreeLists(&c, &h, &f, &l, &c_remakes);
 	return -1;
   }
-  if (ProcessFiles(c, &max_htime, &max_otime, &c_remakes, 1)) { 
+  if (ProcessFiles(c, &max_otime, &c_remakes, 1, db)) { 
 	FreeLists(&c, &h, &f, &l, &c_remakes);
 	return -1;
   }
   if (!dll_empty(c_remakes)) { cmod = 1; }
 
-  /* Remake the C files and executable if needed. */
+  /* Remake the C files and executable if needed, recording what each was
+     built from as it is. */
 
-  dll_traverse(dt, c_remakes) {
-	if (RemakeCFile(dt, f, dt->val.s) == 1) { 
-	  FreeLists(&c, &h, &f, &l, &c_remakes);
-	  return -1;
-	} 
+  failed = RemakeCFiles(c_remakes, f, njobs, db);
+  if (db->cache != NULL && cmod == 1) { TrimCache(db->cache, db->cache_max); }
+  if (failed == 1) {
+	SaveDB(db);
+	FreeLists(&c, &h, &f, &l, &c_remakes);
+	return -1;
   }
-  if (CheckExec(e, max_otime, cmod) == 1) {
-	if (RemakeExec(e, dt, f, l, c) == 1) {
+  if (CheckExec(e, max_otime, cmod, db, c, l) == 1) {
+	if (RemakeExec(e, f, l, c) == 1) {
+	  SaveDB(db);
 	  FreeLists(&c, &h, &f, &l, &c_remakes);
 	  return -1;
 	}
+	if (ExecKey(db, c, l, &key) == 0) { SetKey(db, e, key); }
   } else { printf("%s up to date\n", e); }
 
+  SaveDB(db);
   FreeLists(&c, &h, &f, &l, &c_remakes);
 
   exit(0);